@@ -0,0 +1,520 @@
+#include "bench.h"
+
+#include <glad/egl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// EGL_MESA_platform_surfaceless, not part of the generated glad2 egl header
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+struct headless_context {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+    EGLConfig config = nullptr;
+    EGLContext shared = EGL_NO_CONTEXT;         // --shader-dir reloads
+    EGLSurface shared_surface = EGL_NO_SURFACE; // 1x1 pbuffer, unless surfaceless
+    GLuint fbo = 0;       // only used when there is no pbuffer
+    GLuint color_rb = 0;
+};
+
+// the contexts set_shared_context and start_render_thread make current,
+// there is one bench per run
+headless_context* bench_ctx = nullptr;
+
+bool has_extension(const char* extensions, const char* name) {
+    if (!extensions) return false;
+    size_t len = strlen(name);
+    for (const char* p = strstr(extensions, name); p; p = strstr(p + len, name)) {
+        bool starts = p == extensions || p[-1] == ' ';
+        bool ends = p[len] == ' ' || p[len] == '\0';
+        if (starts && ends) return true;
+    }
+    return false;
+}
+
+EGLDisplay get_headless_display() {
+    // client extensions are queried without a display
+    const char* client_exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if (GLAD_EGL_EXT_platform_base) {
+        // mesa: no window system at all
+        if (has_extension(client_exts, "EGL_MESA_platform_surfaceless")) {
+            EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (display != EGL_NO_DISPLAY) return display;
+        }
+
+        // first enumerated device (e.g. nvidia without x)
+        if (GLAD_EGL_EXT_platform_device && GLAD_EGL_EXT_device_enumeration) {
+            EGLDeviceEXT device;
+            EGLint num_devices = 0;
+            if (eglQueryDevicesEXT(1, &device, &num_devices) && num_devices > 0) {
+                EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+                if (display != EGL_NO_DISPLAY) return display;
+            }
+        }
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool create_headless_context(headless_context* ctx) {
+    // load client side entry points first, the display is not known yet
+    if (!gladLoaderLoadEGL(EGL_NO_DISPLAY)) {
+        std::cerr << "Failed to load EGL" << std::endl;
+        return false;
+    }
+
+    ctx->display = get_headless_display();
+    if (ctx->display == EGL_NO_DISPLAY || !eglInitialize(ctx->display, NULL, NULL)) {
+        std::cerr << "Failed to initialize EGL display" << std::endl;
+        return false;
+    }
+
+    // reload now that display extensions are known
+    if (!gladLoaderLoadEGL(ctx->display)) {
+        std::cerr << "Failed to reload EGL for display" << std::endl;
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    const EGLint surfaceless_config_attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint num_configs = 0;
+    bool pbuffer = eglChooseConfig(ctx->display, config_attribs, &config, 1, &num_configs) && num_configs > 0;
+    if (!pbuffer) {
+        if (!GLAD_EGL_KHR_surfaceless_context ||
+            !eglChooseConfig(ctx->display, surfaceless_config_attribs, &config, 1, &num_configs) ||
+            num_configs == 0) {
+            std::cerr << "No usable EGL config (need pbuffer or surfaceless ES 3 support)" << std::endl;
+            return false;
+        }
+    }
+
+    eglBindAPI(EGL_OPENGL_ES_API);
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 0,
+        EGL_NONE
+    };
+    ctx->context = eglCreateContext(ctx->display, config, EGL_NO_CONTEXT, context_attribs);
+    if (ctx->context == EGL_NO_CONTEXT) {
+        std::cerr << "Failed to create EGL context: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+        return false;
+    }
+    ctx->config = config;
+
+    if (pbuffer) {
+        const EGLint pbuffer_attribs[] = {
+            EGL_WIDTH, window_width,
+            EGL_HEIGHT, window_height,
+            EGL_NONE
+        };
+        ctx->surface = eglCreatePbufferSurface(ctx->display, config, pbuffer_attribs);
+    }
+
+    if (!eglMakeCurrent(ctx->display, ctx->surface, ctx->surface, ctx->context)) {
+        std::cerr << "Failed to make EGL context current: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+        return false;
+    }
+
+    if (!gladLoadGLES2((GLADloadfunc)eglGetProcAddress)) {
+        std::cerr << "Failed to initialize GLAD GLES" << std::endl;
+        return false;
+    }
+
+    // surfaceless: render into an offscreen framebuffer of window size
+    if (ctx->surface == EGL_NO_SURFACE) {
+        glGenRenderbuffers(1, &ctx->color_rb);
+        glBindRenderbuffer(GL_RENDERBUFFER, ctx->color_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window_width, window_height);
+
+        glGenFramebuffers(1, &ctx->fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, ctx->fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, ctx->color_rb);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+            return false;
+        }
+    }
+    glViewport(0, 0, window_width, window_height);
+
+    return true;
+}
+
+// a second context sharing objects with the first, for shader reloads on
+// their own thread. false if the driver will not create one, the reloads
+// then happen between frames
+bool create_shared_context(headless_context* ctx) {
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 0,
+        EGL_NONE
+    };
+    ctx->shared = eglCreateContext(ctx->display, ctx->config, ctx->context, context_attribs);
+    if (ctx->shared == EGL_NO_CONTEXT) return false;
+    if (ctx->surface != EGL_NO_SURFACE) {
+        const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        ctx->shared_surface = eglCreatePbufferSurface(ctx->display, ctx->config, pbuffer_attribs);
+    }
+    bench_ctx = ctx;
+    set_shared_context([](bool current) {
+        if (current) {
+            eglMakeCurrent(bench_ctx->display, bench_ctx->shared_surface, bench_ctx->shared_surface, bench_ctx->shared);
+        } else {
+            eglMakeCurrent(bench_ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        }
+    });
+    return true;
+}
+
+void destroy_headless_context(headless_context* ctx) {
+    if (ctx->display == EGL_NO_DISPLAY) return;
+
+    if (ctx->fbo) glDeleteFramebuffers(1, &ctx->fbo);
+    if (ctx->color_rb) glDeleteRenderbuffers(1, &ctx->color_rb);
+
+    stop_shader_reload();
+    eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (ctx->shared_surface != EGL_NO_SURFACE) eglDestroySurface(ctx->display, ctx->shared_surface);
+    if (ctx->shared != EGL_NO_CONTEXT) eglDestroyContext(ctx->display, ctx->shared);
+    if (ctx->surface != EGL_NO_SURFACE) eglDestroySurface(ctx->display, ctx->surface);
+    if (ctx->context != EGL_NO_CONTEXT) eglDestroyContext(ctx->display, ctx->context);
+    eglTerminate(ctx->display);
+    gladLoaderUnloadEGL();
+}
+
+// --render-thread: the context moves to the render thread, which finishes
+// every frame like the loop without it
+void start_bench_render_thread(headless_context* ctx) {
+    bench_ctx = ctx;
+    start_render_thread(
+        [](bool current) {
+            if (current) {
+                eglMakeCurrent(bench_ctx->display, bench_ctx->surface, bench_ctx->surface, bench_ctx->context);
+            } else {
+                eglMakeCurrent(bench_ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            }
+        },
+        [] { glFinish(); });
+}
+
+// --app-work: spins, a sleep would give the core away
+void busy_work(double ms) {
+    typedef std::chrono::steady_clock clock;
+    clock::time_point end = clock::now() + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double, std::milli>(ms));
+    while (clock::now() < end) {
+    }
+}
+
+// nearest-rank percentile of an ascending sorted sample
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+    rank = std::min(std::max(rank, (size_t)1), sorted.size());
+    return sorted[rank - 1];
+}
+
+std::string json_escape(const char* s) {
+    std::string out;
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') out += '\\';
+        if ((unsigned char)*s < 0x20) continue;
+        out += *s;
+    }
+    return out;
+}
+
+int run_bench(const particle_options& opts, const char* demo_name) {
+    headless_context ctx;
+    if (!create_headless_context(&ctx)) {
+        destroy_headless_context(&ctx);
+        return -1;
+    }
+
+    if (opts.shader_dir && !create_shared_context(&ctx)) {
+        std::cerr << "no shared EGL context, shaders reload between frames" << std::endl;
+    }
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point init_start = clock::now();
+    if (!setup_graphics(opts)) {
+        destroy_headless_context(&ctx);
+        return -1;
+    }
+    glFinish();
+    std::chrono::duration<double> init = clock::now() - init_start;
+
+    // warm up shader caches and driver allocations before measuring
+    for (int i = 0; i < opts.bench_warmup; i++) {
+        render_frame(opts.bench_delta_time);
+    }
+    glFinish();
+
+    validation_result validation = { 0, 0, 0.0f, 0.0f };
+    if (opts.validate) {
+        validation = validate_update((float)(opts.step > 0.0 ? opts.step : opts.bench_delta_time), opts.isa);
+    }
+    glFinish();
+    reset_sim_stats();
+
+    // glFinish ends every frame so the sample is the full gpu time of the
+    // frame, not just the time it took to queue the commands. with the
+    // render thread a sample is one turn of this loop, which keeps pace
+    // with the slower of the two threads once the queue is full
+    std::vector<double> frame_ms;
+    frame_ms.reserve(opts.bench_frames);
+
+    if (opts.render_thread) start_bench_render_thread(&ctx);
+    clock::time_point start = clock::now();
+    for (int i = 0; i < opts.bench_frames; i++) {
+        clock::time_point frame_start = clock::now();
+        if (opts.bench_app_ms > 0.0) busy_work(opts.bench_app_ms);
+        if (opts.render_thread) {
+            submit_frame(opts.bench_delta_time);
+        } else {
+            render_frame(opts.bench_delta_time);
+            glFinish();
+        }
+        std::chrono::duration<double, std::milli> elapsed = clock::now() - frame_start;
+        frame_ms.push_back(elapsed.count());
+    }
+    // the frames still queued are part of the run
+    stop_render_thread();
+    std::chrono::duration<double> total = clock::now() - start;
+
+    stop_shader_reload();
+    close_snapshots();
+    std::chrono::duration<double> checkpoint_save(0.0);
+    if (opts.checkpoint_path) {
+        clock::time_point save_start = clock::now();
+        if (!save_checkpoint(opts.checkpoint_path)) {
+            destroy_headless_context(&ctx);
+            return -1;
+        }
+        checkpoint_save = clock::now() - save_start;
+    }
+    sim_stats stats = get_sim_stats();
+    uint64_t state_hash = hash_state();
+    std::vector<double> sorted = frame_ms;
+    std::sort(sorted.begin(), sorted.end());
+    double mean_ms = total.count() * 1000.0 / opts.bench_frames;
+    double particles_per_second = (double)opts.num_particles * opts.bench_frames / total.count();
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << "{\n"
+              << "  \"demo\": \"" << json_escape(demo_name) << "\",\n"
+              << "  \"gl_renderer\": \"" << json_escape((const char*)glGetString(GL_RENDERER)) << "\",\n"
+              << "  \"gl_version\": \"" << json_escape((const char*)glGetString(GL_VERSION)) << "\",\n"
+              << "  \"surface\": \"" << (ctx.surface != EGL_NO_SURFACE ? "pbuffer" : "surfaceless") << "\",\n"
+              << "  \"particles\": " << opts.num_particles << ",\n"
+              << "  \"chunk_size\": " << opts.chunk_size << ",\n"
+              << "  \"backend\": \"" << sim_backend_name(stats.backend) << "\",\n"
+              << "  \"cpu_isa\": \"" << cpu_isa_name(opts.isa) << "\",\n"
+              << "  \"workgroup_size\": " << stats.workgroup_size << ",\n"
+              << "  \"format\": \"" << position_format_name(stats.format) << "\",\n"
+              << "  \"threads\": " << stats.threads << ",\n"
+              << "  \"frames\": " << opts.bench_frames << ",\n"
+              << "  \"warmup_frames\": " << opts.bench_warmup << ",\n"
+              << "  \"delta_time\": " << std::setprecision(6) << opts.bench_delta_time << ",\n"
+              << "  \"app_work_ms\": " << std::setprecision(4) << opts.bench_app_ms << ",\n"
+              << "  \"init_seconds\": " << std::setprecision(4) << init.count() << ",\n"
+              << "  \"total_seconds\": " << total.count() << ",\n"
+              << "  \"particles_per_second\": " << std::setprecision(0) << particles_per_second << ",\n"
+              << std::setprecision(4)
+              << "  \"frame_ms\": {\n"
+              << "    \"mean\": " << mean_ms << ",\n"
+              << "    \"min\": " << sorted.front() << ",\n"
+              << "    \"p50\": " << percentile(sorted, 50) << ",\n"
+              << "    \"p95\": " << percentile(sorted, 95) << ",\n"
+              << "    \"p99\": " << percentile(sorted, 99) << ",\n"
+              << "    \"max\": " << sorted.back() << "\n"
+              << "  }";
+
+    // the slower pass on the gpu if it was timed, on the cpu otherwise
+    bool update_bound = stats.gpu_timer && stats.timed_frames > 0
+                      ? stats.update_gpu_ms > stats.render_gpu_ms
+                      : stats.update_cpu_ms > stats.render_cpu_ms;
+    std::cout << ",\n"
+              << "  \"passes\": {\n"
+              << "    \"gpu_timer\": " << (stats.gpu_timer ? "true" : "false") << ",\n"
+              << "    \"timed_frames\": " << stats.timed_frames << ",\n"
+              << "    \"dropped_frames\": " << stats.dropped_frames << ",\n"
+              << "    \"update_cpu_ms\": " << stats.update_cpu_ms << ",\n"
+              << "    \"render_cpu_ms\": " << stats.render_cpu_ms << ",\n"
+              << "    \"update_bytes_per_particle\": " << stats.update_bytes << ",\n"
+              << "    \"velocity\": \"" << (stats.procedural_velocity ? "procedural" : "buffer") << "\",\n"
+              << "    \"render\": \"" << render_mode_name(stats.render) << "\",\n"
+              << "    \"update_gpu_ms\": " << stats.update_gpu_ms << ",\n"
+              << "    \"render_gpu_ms\": " << stats.render_gpu_ms << ",\n"
+              << "    \"bound\": \"" << (update_bound ? "update" : "render") << "\"\n"
+              << "  }";
+    std::cout << ",\n"
+              << "  \"timestep\": {\n"
+              << "    \"step\": " << std::setprecision(6) << stats.step << ",\n"
+              << "    \"sim_time\": " << stats.sim_time << ",\n"
+              << "    \"steps\": " << stats.sim_steps << ",\n"
+              << "    \"most_substeps\": " << stats.most_substeps << ",\n"
+              << "    \"dropped_seconds\": " << stats.dropped_seconds << ",\n"
+              << "    \"state_hash\": \"" << std::hex << std::setw(16) << std::setfill('0') << state_hash
+              << std::dec << std::setfill(' ') << "\"\n"
+              << "  }" << std::setprecision(4);
+    std::cout << ",\n"
+              << "  \"init\": {\n"
+              << "    \"source\": \"" << stats.init << "\",\n"
+              << "    \"seed\": " << opts.seed << ",\n"
+              << "    \"state_seconds\": " << stats.init_seconds;
+    if (stats.init_mismatches >= 0) {
+        std::cout << ",\n"
+                  << "    \"mismatches\": " << stats.init_mismatches;
+    }
+    std::cout << "\n"
+              << "  }";
+    std::cout << ",\n"
+              << "  \"programs\": {\n"
+              << "    \"count\": " << stats.programs << ",\n"
+              << "    \"cache\": " << (stats.program_cache ? "true" : "false") << ",\n"
+              << "    \"cache_hits\": " << stats.program_cache_hits << ",\n"
+              << "    \"rejected\": " << stats.program_cache_rejected << ",\n"
+              << "    \"parallel\": " << (stats.parallel_compile ? "true" : "false") << ",\n"
+              << "    \"ready\": " << stats.programs_ready << ",\n"
+              << "    \"seconds\": " << stats.program_seconds << "\n"
+              << "  }";
+    if (stats.state_cache) {
+        long long issued = 0, elided = 0;
+        for (int k = 0; k < num_state_kinds; k++) {
+            issued += stats.state_calls.issued[k];
+            elided += stats.state_calls.elided[k];
+        }
+        std::cout << ",\n"
+                  << "  \"state_cache\": {\n"
+                  << "    \"issued\": " << issued << ",\n"
+                  << "    \"elided\": " << elided;
+        for (int k = 0; k < num_state_kinds; k++) {
+            std::cout << ",\n"
+                      << "    \"" << state_kind_name((state_kind)k) << "\": { \"issued\": " << stats.state_calls.issued[k]
+                      << ", \"elided\": " << stats.state_calls.elided[k] << " }";
+        }
+        std::cout << "\n"
+                  << "  }";
+    }
+    if (stats.render_thread) {
+        std::cout << ",\n"
+                  << "  \"render_thread\": {\n"
+                  << "    \"submit_waits\": " << stats.submit_waits << ",\n"
+                  << "    \"render_waits\": " << stats.render_waits << "\n"
+                  << "  }";
+    }
+    if (opts.shader_dir) {
+        std::cout << ",\n"
+                  << "  \"shader_reload\": {\n"
+                  << "    \"dir\": \"" << json_escape(opts.shader_dir) << "\",\n"
+                  << "    \"shared_context\": " << (ctx.shared != EGL_NO_CONTEXT ? "true" : "false") << ",\n"
+                  << "    \"reloads\": " << stats.shader_reloads << ",\n"
+                  << "    \"failures\": " << stats.shader_reload_failures << "\n"
+                  << "  }";
+    }
+    if (opts.lifetime > 0.0) {
+        std::cout << ",\n"
+                  << "  \"emission\": {\n"
+                  << "    \"lifetime\": " << opts.lifetime << ",\n"
+                  << "    \"spawned\": " << stats.spawned << ",\n"
+                  << "    \"live_particles\": " << stats.live_particles << "\n"
+                  << "  }";
+    }
+    if (stats.max_size > 0.0f) {
+        std::cout << ",\n"
+                  << "  \"sizes\": {\n"
+                  << "    \"max_size\": " << stats.max_size << ",\n"
+                  << "    \"point_size_limit\": " << stats.point_size_limit << "\n"
+                  << "  }";
+    }
+    if (stats.record != RECORD_NONE) {
+        std::cout << ",\n"
+                  << "  \"record\": {\n"
+                  << "    \"layout\": \"" << record_mode_name(stats.record) << "\",\n"
+                  << "    \"bytes_per_particle\": " << stats.record_bytes << "\n"
+                  << "  }";
+    }
+    if (stats.systems > 1) {
+        std::cout << ",\n"
+                  << "  \"systems\": {\n"
+                  << "    \"count\": " << stats.systems << ",\n"
+                  << "    \"draw\": \"" << (stats.multi_draw ? "multi_draw_arrays" : "draw_arrays") << "\"\n"
+                  << "  }";
+    }
+    if (stats.ring_slots > 1) {
+        std::cout << ",\n"
+                  << "  \"ring\": {\n"
+                  << "    \"slots\": " << stats.ring_slots << ",\n"
+                  << "    \"stalls\": " << stats.ring_stalls << "\n"
+                  << "  }";
+    }
+    if (stats.upload) {
+        std::cout << ",\n"
+                  << "  \"upload\": {\n"
+                  << "    \"mode\": \"" << stats.upload << "\",\n"
+                  << "    \"stalls\": " << stats.upload_stalls << ",\n"
+                  << "    \"map_failures\": " << stats.upload_map_failures << "\n"
+                  << "  }";
+    }
+    if (stats.reorder_every > 0) {
+        std::cout << ",\n"
+                  << "  \"reorder\": {\n"
+                  << "    \"every\": " << stats.reorder_every << ",\n"
+                  << "    \"passes\": " << stats.reorders << ",\n"
+                  << "    \"mean_ms\": " << (stats.reorders ? stats.reorder_seconds * 1000.0 / stats.reorders : 0.0) << "\n"
+                  << "  }";
+    }
+    if (stats.snapshot_every > 0) {
+        std::cout << ",\n"
+                  << "  \"snapshots\": {\n"
+                  << "    \"every\": " << stats.snapshot_every << ",\n"
+                  << "    \"written\": " << stats.snapshots_written << ",\n"
+                  << "    \"dropped\": " << stats.snapshots_dropped << ",\n"
+                  << "    \"bytes\": " << stats.snapshot_bytes << "\n"
+                  << "  }";
+    }
+    if (opts.checkpoint_path || opts.restore_path) {
+        // init_seconds is the restore time with --restore
+        std::cout << ",\n"
+                  << "  \"checkpoint\": {\n"
+                  << "    \"restored\": " << (opts.restore_path ? "true" : "false") << ",\n"
+                  << "    \"save_seconds\": " << checkpoint_save.count() << "\n"
+                  << "  }";
+    }
+    if (opts.validate) {
+        std::cout << ",\n"
+                  << "  \"validation\": {\n"
+                  << "    \"checked\": " << validation.checked << ",\n"
+                  << "    \"mismatches\": " << validation.mismatches << ",\n"
+                  << "    \"max_error\": " << std::setprecision(6) << validation.max_error << ",\n"
+                  << "    \"tolerance\": " << validation.tolerance << "\n"
+                  << "  }";
+    }
+    std::cout << "\n}" << std::endl;
+
+    destroy_headless_context(&ctx);
+    return validation.mismatches == 0 && stats.init_mismatches <= 0 ? 0 : 1;
+}
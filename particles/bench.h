@@ -0,0 +1,13 @@
+#ifndef PARTICLES_BENCH_H_
+#define PARTICLES_BENCH_H_
+
+#include "particles.h"
+
+// headless benchmark: creates its own EGL context (pbuffer, or surfaceless
+// plus an offscreen framebuffer), runs render_frame for a fixed number of
+// frames with a fixed delta time and prints a json report to stdout.
+// does not need GLFW or a display, Mesa llvmpipe works fine.
+// returns the process exit code.
+int run_bench(const particle_options& opts, const char* demo_name);
+
+#endif  // PARTICLES_BENCH_H_
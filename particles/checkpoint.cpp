@@ -0,0 +1,158 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + checkpoint_alignment - 1) / checkpoint_alignment * checkpoint_alignment;
+}
+
+void checkpoint_layout(checkpoint_header* header, uint32_t count, uint32_t position_size) {
+    memcpy(header->magic, "PCKPT001", 8);
+    header->version = checkpoint_version;
+    header->count = count;
+    header->reserved = 0;
+    header->positions_offset = align_up(sizeof(checkpoint_header));
+    header->positions_size = (uint64_t)count * position_size;
+    header->velocities_offset = align_up(header->positions_offset + header->positions_size);
+    header->velocities_size = (uint64_t)count * 2 * sizeof(float);
+}
+
+bool write_checkpoint(const char* path, const checkpoint_header& header,
+                      const void* positions, const void* velocities) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        std::cerr << "failed to create checkpoint " << path << std::endl;
+        return false;
+    }
+
+    std::vector<char> padding(checkpoint_alignment, 0);
+    uint64_t offset = 0;
+    bool ok = true;
+    auto write_at = [&](uint64_t at, const void* data, uint64_t size) {
+        if (at > offset) ok = ok && fwrite(padding.data(), 1, (size_t)(at - offset), file) == at - offset;
+        ok = ok && fwrite(data, 1, (size_t)size, file) == size;
+        offset = at + size;
+    };
+    write_at(0, &header, sizeof(header));
+    write_at(header.positions_offset, positions, header.positions_size);
+    write_at(header.velocities_offset, velocities, header.velocities_size);
+    if (fclose(file) != 0) ok = false;
+
+    if (!ok) std::cerr << "failed to write checkpoint " << path << std::endl;
+    return ok;
+}
+
+// written so a corrupt offset or length cannot wrap around uint64
+static bool section_fits(uint64_t offset, uint64_t length, uint64_t size) {
+    return offset <= size && length <= size - offset;
+}
+
+static bool check_header(const char* path, checkpoint_mapping* mapping) {
+    if (mapping->size < sizeof(checkpoint_header)) {
+        std::cerr << path << " is not a particle checkpoint" << std::endl;
+        return false;
+    }
+    memcpy(&mapping->header, mapping->base, sizeof(checkpoint_header));
+    const checkpoint_header& header = mapping->header;
+    if (memcmp(header.magic, "PCKPT001", 8) != 0 || header.version != checkpoint_version) {
+        std::cerr << path << " is not a version " << checkpoint_version << " particle checkpoint" << std::endl;
+        return false;
+    }
+    if (!section_fits(header.positions_offset, header.positions_size, mapping->size) ||
+        !section_fits(header.velocities_offset, header.velocities_size, mapping->size) ||
+        header.velocities_size != (uint64_t)header.count * 2 * sizeof(float)) {
+        std::cerr << path << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    const char* bytes = (const char*)mapping->base;
+    mapping->positions = bytes + header.positions_offset;
+    mapping->velocities = (const float*)(bytes + header.velocities_offset);
+    return true;
+}
+
+#ifdef _WIN32
+
+bool map_checkpoint(const char* path, checkpoint_mapping* mapping) {
+    memset(mapping, 0, sizeof(*mapping));
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "failed to open checkpoint " << path << std::endl;
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    mapping->handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);  // the mapping object keeps the file open
+    if (mapping->handle) mapping->base = MapViewOfFile(mapping->handle, FILE_MAP_READ, 0, 0, 0);
+    if (!mapping->base) {
+        std::cerr << "failed to map checkpoint " << path << std::endl;
+        unmap_checkpoint(mapping);
+        return false;
+    }
+    mapping->size = (size_t)size.QuadPart;
+
+    if (!check_header(path, mapping)) {
+        unmap_checkpoint(mapping);
+        return false;
+    }
+    return true;
+}
+
+void unmap_checkpoint(checkpoint_mapping* mapping) {
+    if (mapping->base) UnmapViewOfFile(mapping->base);
+    if (mapping->handle) CloseHandle((HANDLE)mapping->handle);
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+#else
+
+bool map_checkpoint(const char* path, checkpoint_mapping* mapping) {
+    memset(mapping, 0, sizeof(*mapping));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "failed to open checkpoint " << path << std::endl;
+        return false;
+    }
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);  // the mapping keeps the file open
+    if (base == MAP_FAILED) {
+        std::cerr << "failed to map checkpoint " << path << std::endl;
+        return false;
+    }
+    mapping->base = base;
+    mapping->size = (size_t)st.st_size;
+    // the upload reads it front to back once, start reading ahead now
+    madvise(base, mapping->size, MADV_SEQUENTIAL);
+    madvise(base, mapping->size, MADV_WILLNEED);
+
+    if (!check_header(path, mapping)) {
+        unmap_checkpoint(mapping);
+        return false;
+    }
+    return true;
+}
+
+void unmap_checkpoint(checkpoint_mapping* mapping) {
+    if (mapping->base) munmap(mapping->base, mapping->size);
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+#endif
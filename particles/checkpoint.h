@@ -0,0 +1,58 @@
+#ifndef PARTICLES_CHECKPOINT_H_
+#define PARTICLES_CHECKPOINT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// simulation checkpoint, laid out so that restoring it is one upload per
+// buffer straight out of a read only mapping of the file. all fields little
+// endian, the sections start on checkpoint_alignment boundaries:
+//
+//     header      checkpoint_header
+//     positions   count positions in position_format, as in the gpu buffer
+//     velocities  count vec2 floats
+
+const uint32_t checkpoint_version = 1;
+const uint64_t checkpoint_alignment = 4096;
+
+struct checkpoint_header {
+    char magic[8];               // "PCKPT001"
+    uint32_t version;
+    uint32_t position_format;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t rng_seed;           // seed of the initial state
+    uint64_t rng_counter;        // draws taken from it since, the emitter's spawn serial
+    double sim_time;             // simulated seconds
+    double accumulator;          // frame time not simulated yet
+    int64_t steps;
+    uint64_t positions_offset;
+    uint64_t positions_size;
+    uint64_t velocities_offset;
+    uint64_t velocities_size;
+};
+
+// fills in magic, version and the section offsets and sizes for count
+// particles of position_size bytes
+void checkpoint_layout(checkpoint_header* header, uint32_t count, uint32_t position_size);
+
+// writes header and the two sections, false (after printing why) on failure
+bool write_checkpoint(const char* path, const checkpoint_header& header,
+                      const void* positions, const void* velocities);
+
+// a checkpoint mapped read only, the sections point into the mapping
+struct checkpoint_mapping {
+    checkpoint_header header;
+    const void* positions;
+    const float* velocities;
+    void* base;
+    size_t size;
+    void* handle;               // file mapping object on windows
+};
+
+// maps the file and checks the header against its size. false (after
+// printing why) if it cannot be mapped or is not a checkpoint
+bool map_checkpoint(const char* path, checkpoint_mapping* mapping);
+void unmap_checkpoint(checkpoint_mapping* mapping);
+
+#endif  // PARTICLES_CHECKPOINT_H_
@@ -0,0 +1,266 @@
+#include "cpu_kernel.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PARTICLES_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+// glsl mod(x, y) = x - y * floor(x / y)
+static inline float glsl_mod(float x, float y) {
+    float q = x / y;
+    float f = floorf(q);
+    float p = y * f;
+    return x - p;
+}
+
+static inline float update_scalar(float old_position, float velocity, float delta_time, float m) {
+    float d = velocity * delta_time;
+    float n = old_position + d;
+    return glsl_mod(glsl_mod(n, m) + m, m);
+}
+
+// floats [first, last) of the interleaved stream, even indices are x
+static void update_range_scalar(const float* old_positions, const float* velocities, float* new_positions,
+                                int first, int last, float delta_time, float canvas_width, float canvas_height) {
+    for (int i = first; i < last; i++) {
+        float m = (i & 1) ? canvas_height : canvas_width;
+        new_positions[i] = update_scalar(old_positions[i], velocities[i], delta_time, m);
+    }
+}
+
+#ifdef PARTICLES_X86_64
+
+// sse2 has no floor, truncate and fix up negatives. values of 2^23 and up
+// are integral already (and may not fit the int conversion)
+static inline __m128 floor_sse2(__m128 x) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 big = _mm_set1_ps(8388608.0f);
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    __m128 r = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), one));
+    __m128 is_big = _mm_cmpge_ps(_mm_and_ps(x, abs_mask), big);
+    return _mm_or_ps(_mm_and_ps(is_big, x), _mm_andnot_ps(is_big, r));
+}
+
+static inline __m128 mod_sse2(__m128 x, __m128 y) {
+    __m128 f = floor_sse2(_mm_div_ps(x, y));
+    return _mm_sub_ps(x, _mm_mul_ps(y, f));
+}
+
+static int update_sse2(const float* old_positions, const float* velocities, float* new_positions,
+                       int num_floats, float delta_time, float canvas_width, float canvas_height) {
+    const __m128 dt = _mm_set1_ps(delta_time);
+    const __m128 m = _mm_setr_ps(canvas_width, canvas_height, canvas_width, canvas_height);
+
+    int i = 0;
+    for (; i + 4 <= num_floats; i += 4) {
+        __m128 p = _mm_loadu_ps(old_positions + i);
+        __m128 v = _mm_loadu_ps(velocities + i);
+        __m128 n = _mm_add_ps(p, _mm_mul_ps(v, dt));
+        _mm_storeu_ps(new_positions + i, mod_sse2(_mm_add_ps(mod_sse2(n, m), m), m));
+    }
+    return i;
+}
+
+TARGET_AVX2 static inline __m256 mod_avx2(__m256 x, __m256 y) {
+    __m256 f = _mm256_floor_ps(_mm256_div_ps(x, y));
+    return _mm256_sub_ps(x, _mm256_mul_ps(y, f));
+}
+
+TARGET_AVX2 static int update_avx2(const float* old_positions, const float* velocities, float* new_positions,
+                                   int num_floats, float delta_time, float canvas_width, float canvas_height) {
+    const __m256 dt = _mm256_set1_ps(delta_time);
+    const __m256 m = _mm256_setr_ps(canvas_width, canvas_height, canvas_width, canvas_height,
+                                    canvas_width, canvas_height, canvas_width, canvas_height);
+
+    int i = 0;
+    for (; i + 8 <= num_floats; i += 8) {
+        __m256 p = _mm256_loadu_ps(old_positions + i);
+        __m256 v = _mm256_loadu_ps(velocities + i);
+        __m256 n = _mm256_add_ps(p, _mm256_mul_ps(v, dt));
+        _mm256_storeu_ps(new_positions + i, mod_avx2(_mm256_add_ps(mod_avx2(n, m), m), m));
+    }
+    return i;
+}
+
+TARGET_AVX512 static inline __m512 mod_avx512(__m512 x, __m512 y) {
+    __m512 q = _mm512_div_ps(x, y);
+    __m512 f = _mm512_mask_roundscale_ps(q, 0xffff, q, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    return _mm512_sub_ps(x, _mm512_mul_ps(y, f));
+}
+
+TARGET_AVX512 static int update_avx512(const float* old_positions, const float* velocities, float* new_positions,
+                                       int num_floats, float delta_time, float canvas_width, float canvas_height) {
+    const __m512 dt = _mm512_set1_ps(delta_time);
+    const __m512 m = _mm512_setr_ps(canvas_width, canvas_height, canvas_width, canvas_height,
+                                    canvas_width, canvas_height, canvas_width, canvas_height,
+                                    canvas_width, canvas_height, canvas_width, canvas_height,
+                                    canvas_width, canvas_height, canvas_width, canvas_height);
+
+    int i = 0;
+    for (; i + 16 <= num_floats; i += 16) {
+        __m512 p = _mm512_loadu_ps(old_positions + i);
+        __m512 v = _mm512_loadu_ps(velocities + i);
+        __m512 n = _mm512_add_ps(p, _mm512_mul_ps(v, dt));
+        _mm512_storeu_ps(new_positions + i, mod_avx512(_mm512_add_ps(mod_avx512(n, m), m), m));
+    }
+    return i;
+}
+
+static bool cpu_supports(cpu_isa isa) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymm_state = (xcr0 & 0x6) == 0x6;
+    bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+    int ebx7 = 0;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        ebx7 = info[1];
+    }
+    switch (isa) {
+        case CPU_ISA_AVX2: return avx && ymm_state && (ebx7 & (1 << 5));
+        case CPU_ISA_AVX512: return avx && zmm_state && (ebx7 & (1 << 16));
+        default: return true;
+    }
+#else
+    __builtin_cpu_init();
+    switch (isa) {
+        case CPU_ISA_AVX2: return __builtin_cpu_supports("avx2");
+        case CPU_ISA_AVX512: return __builtin_cpu_supports("avx512f");
+        default: return true;
+    }
+#endif
+}
+
+#else
+
+static bool cpu_supports(cpu_isa isa) {
+    return isa == CPU_ISA_SCALAR;
+}
+
+#endif  // PARTICLES_X86_64
+
+cpu_isa cpu_isa_detect() {
+    static const cpu_isa isas[] = { CPU_ISA_AVX512, CPU_ISA_AVX2, CPU_ISA_SSE2 };
+    for (cpu_isa isa : isas) {
+        if (cpu_supports(isa)) return isa;
+    }
+    return CPU_ISA_SCALAR;
+}
+
+bool cpu_isa_supported(cpu_isa isa) {
+    return cpu_supports(isa);
+}
+
+const char* cpu_isa_name(cpu_isa isa) {
+    switch (isa) {
+        case CPU_ISA_SSE2: return "sse2";
+        case CPU_ISA_AVX2: return "avx2";
+        case CPU_ISA_AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+bool cpu_isa_parse(const char* name, cpu_isa* isa) {
+    if (strcmp(name, "auto") == 0) *isa = cpu_isa_detect();
+    else if (strcmp(name, "scalar") == 0) *isa = CPU_ISA_SCALAR;
+    else if (strcmp(name, "sse2") == 0) *isa = CPU_ISA_SSE2;
+    else if (strcmp(name, "avx2") == 0) *isa = CPU_ISA_AVX2;
+    else if (strcmp(name, "avx512") == 0) *isa = CPU_ISA_AVX512;
+    else return false;
+    return true;
+}
+
+void cpu_update_positions(cpu_isa isa, const float* old_positions, const float* velocities,
+                          float* new_positions, int count, float delta_time,
+                          float canvas_width, float canvas_height) {
+    if (!cpu_supports(isa)) isa = cpu_isa_detect();
+
+    // the simd loops stop at a multiple of their width, the scalar loop
+    // finishes the tail. vector widths are even so x/y lanes stay aligned
+    int num_floats = count * 2;
+    int done = 0;
+    switch (isa) {
+#ifdef PARTICLES_X86_64
+        case CPU_ISA_SSE2:
+            done = update_sse2(old_positions, velocities, new_positions, num_floats, delta_time, canvas_width, canvas_height);
+            break;
+        case CPU_ISA_AVX2:
+            done = update_avx2(old_positions, velocities, new_positions, num_floats, delta_time, canvas_width, canvas_height);
+            break;
+        case CPU_ISA_AVX512:
+            done = update_avx512(old_positions, velocities, new_positions, num_floats, delta_time, canvas_width, canvas_height);
+            break;
+#endif
+        default:
+            break;
+    }
+    update_range_scalar(old_positions, velocities, new_positions, done, num_floats, delta_time, canvas_width, canvas_height);
+}
+
+// largest float below 2^31, the step has to survive the int conversion
+static const float max_fixed_step = 2147483520.0f;
+
+static inline uint32_t fixed_step(float velocity, float delta_time, float scale) {
+    float d = velocity * delta_time;
+    float s = floorf(d * scale + 0.5f);
+    if (s > max_fixed_step) s = max_fixed_step;
+    if (s < -max_fixed_step) s = -max_fixed_step;
+    return (uint32_t)(int32_t)s;
+}
+
+void cpu_update_positions_fixed32(const uint32_t* old_positions, const float* velocities,
+                                  uint32_t* new_positions, int count, float delta_time,
+                                  float scale_x, float scale_y) {
+    for (int i = 0; i < count; i++) {
+        new_positions[2 * i + 0] = old_positions[2 * i + 0] + fixed_step(velocities[2 * i + 0], delta_time, scale_x);
+        new_positions[2 * i + 1] = old_positions[2 * i + 1] + fixed_step(velocities[2 * i + 1], delta_time, scale_y);
+    }
+}
+
+void cpu_update_positions_fixed16(const uint32_t* old_positions, const float* velocities,
+                                  uint32_t* new_positions, int count, float delta_time,
+                                  float scale_x, float scale_y) {
+    for (int i = 0; i < count; i++) {
+        uint32_t x = (old_positions[i] + fixed_step(velocities[2 * i + 0], delta_time, scale_x)) & 0xffff;
+        uint32_t y = ((old_positions[i] >> 16) + fixed_step(velocities[2 * i + 1], delta_time, scale_y)) & 0xffff;
+        new_positions[i] = x | (y << 16);
+    }
+}
+
+uint32_t fixed_encode(float position, float canvas_size, int bits) {
+    double f = (double)position / canvas_size;
+    f -= floor(f);
+    uint64_t value = (uint64_t)(f * (double)(1ull << bits));
+    return (uint32_t)(value & ((1ull << bits) - 1));
+}
+
+float fixed_decode(uint32_t value, float canvas_size, int bits) {
+    return (float)((double)value * canvas_size / (double)(1ull << bits));
+}
+
+float wrapped_distance(float a, float b, float canvas_size) {
+    float d = fabsf(a - b);
+    return d < canvas_size - d ? d : canvas_size - d;
+}
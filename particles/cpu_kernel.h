@@ -0,0 +1,71 @@
+#ifndef PARTICLES_CPU_KERNEL_H_
+#define PARTICLES_CPU_KERNEL_H_
+
+#include <cstdint>
+
+// cpu implementation of update_vert_shader:
+//
+//     new_position = euclidean_modulo(old_position + velocity * delta_time, canvas_size)
+//
+// with glsl's mod(x, y) = x - y * floor(x / y), evaluated in the same order
+// as the shader (true division, no fused multiply-add). all isa paths give
+// bit identical results to each other.
+//
+// against the transform feedback output the results are equal up to
+// cpu_kernel_tolerance (wrap-aware distance, in pixels): glsl es allows
+// 2.5 ulp for division and drivers are free to fuse the multiply-adds, so
+// a gpu can be off by a few ulp of canvas_size, and a value landing exactly
+// on the wrap edge may come out as 0 on one side and canvas_size on the other.
+
+// simd paths, picked at runtime. everything that is not x86-64 only has
+// the scalar path
+enum cpu_isa {
+    CPU_ISA_SCALAR,
+    CPU_ISA_SSE2,
+    CPU_ISA_AVX2,
+    CPU_ISA_AVX512,
+};
+
+const float cpu_kernel_tolerance = 1.0f / 256;
+
+// widest path supported by this cpu (and the os)
+cpu_isa cpu_isa_detect();
+// whether this cpu (and the os) can run the path
+bool cpu_isa_supported(cpu_isa isa);
+const char* cpu_isa_name(cpu_isa isa);
+// accepts "scalar", "sse2", "avx2", "avx512" and "auto"
+bool cpu_isa_parse(const char* name, cpu_isa* isa);
+
+// positions and velocities are interleaved xy pairs, the layout of the gpu
+// buffers. for separate x and y streams call it once per stream with count
+// halved and both canvas sizes set to that axis. new_positions may alias
+// old_positions. falls back to the widest supported path if isa is not
+// supported by this cpu
+void cpu_update_positions(cpu_isa isa, const float* old_positions, const float* velocities,
+                          float* new_positions, int count, float delta_time,
+                          float canvas_width, float canvas_height);
+
+// fixed point positions: each axis is an unsigned fraction of its canvas
+// size in 2^32 (fixed32, one uint32 per axis) or 2^16 (fixed16, x in the
+// low and y in the high half of one uint32) steps, so wrapping around the
+// canvas is plain integer overflow. a step moves by
+//
+//     floor(velocity * delta_time * scale + 0.5)
+//
+// units, scale being 2^bits / canvas_size, clamped to what fits an int32.
+// same evaluation order as the fixed point update shaders
+void cpu_update_positions_fixed32(const uint32_t* old_positions, const float* velocities,
+                                  uint32_t* new_positions, int count, float delta_time,
+                                  float scale_x, float scale_y);
+void cpu_update_positions_fixed16(const uint32_t* old_positions, const float* velocities,
+                                  uint32_t* new_positions, int count, float delta_time,
+                                  float scale_x, float scale_y);
+
+// conversions for one axis, position in [0, canvas_size), bits 32 or 16
+uint32_t fixed_encode(float position, float canvas_size, int bits);
+float fixed_decode(uint32_t value, float canvas_size, int bits);
+
+// distance between two positions on one wrapped axis
+float wrapped_distance(float a, float b, float canvas_size);
+
+#endif  // PARTICLES_CPU_KERNEL_H_
@@ -0,0 +1,186 @@
+#include "initial_state.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PARTICLES_X86_64 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+// lowbias32, the same hash as lowbias32_shader
+static inline uint32_t lowbias32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+void initial_state_setup(initial_state_params* params, uint32_t seed,
+                         float canvas_width, float canvas_height, float max_speed) {
+    for (uint32_t c = 0; c < 4; c++) {
+        params->keys[c] = lowbias32(seed + c * 0x9e3779b9u);
+    }
+    params->position_scale_x = canvas_width * (1.0f / 16777216.0f);
+    params->position_scale_y = canvas_height * (1.0f / 16777216.0f);
+    params->velocity_scale = max_speed * (1.0f / 8388608.0f);
+}
+
+static void generate_scalar(const initial_state_params& params, float* positions, float* velocities,
+                            int first, int last) {
+    for (int i = first; i < last; i++) {
+        uint32_t h = lowbias32((uint32_t)i);
+        uint32_t x = lowbias32(h ^ params.keys[0]) >> 8;
+        uint32_t y = lowbias32(h ^ params.keys[1]) >> 8;
+        uint32_t vx = lowbias32(h ^ params.keys[2]) >> 8;
+        uint32_t vy = lowbias32(h ^ params.keys[3]) >> 8;
+        positions[2 * i + 0] = (float)x * params.position_scale_x;
+        positions[2 * i + 1] = (float)y * params.position_scale_y;
+        velocities[2 * i + 0] = (float)((int32_t)vx - 8388608) * params.velocity_scale;
+        velocities[2 * i + 1] = (float)((int32_t)vy - 8388608) * params.velocity_scale;
+    }
+}
+
+#ifdef PARTICLES_X86_64
+
+// the simd paths work on the interleaved streams directly: lane j holds
+// component j & 1 of particle first + j / 2, so the index is hashed once
+// per lane and the stores need no shuffles
+
+// sse2 has no 32 bit multiply, two 64 bit ones on the even and odd lanes
+static inline __m128i mullo_sse2(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i lowbias32_sse2(__m128i x) {
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = mullo_sse2(x, _mm_set1_epi32(0x7feb352d));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = mullo_sse2(x, _mm_set1_epi32((int)0x846ca68bu));
+    return _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+}
+
+static int generate_sse2(const initial_state_params& params, float* positions, float* velocities,
+                         int first, int last) {
+    const __m128i position_keys = _mm_setr_epi32((int)params.keys[0], (int)params.keys[1], (int)params.keys[0], (int)params.keys[1]);
+    const __m128i velocity_keys = _mm_setr_epi32((int)params.keys[2], (int)params.keys[3], (int)params.keys[2], (int)params.keys[3]);
+    const __m128 position_scale = _mm_setr_ps(params.position_scale_x, params.position_scale_y,
+                                              params.position_scale_x, params.position_scale_y);
+    const __m128 velocity_scale = _mm_set1_ps(params.velocity_scale);
+    const __m128i half = _mm_set1_epi32(8388608);
+
+    int i = first;
+    for (; i + 2 <= last; i += 2) {
+        __m128i h = lowbias32_sse2(_mm_setr_epi32(i, i, i + 1, i + 1));
+        __m128i p = _mm_srli_epi32(lowbias32_sse2(_mm_xor_si128(h, position_keys)), 8);
+        __m128i v = _mm_srli_epi32(lowbias32_sse2(_mm_xor_si128(h, velocity_keys)), 8);
+        _mm_storeu_ps(positions + 2 * i, _mm_mul_ps(_mm_cvtepi32_ps(p), position_scale));
+        _mm_storeu_ps(velocities + 2 * i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(v, half)), velocity_scale));
+    }
+    return i;
+}
+
+TARGET_AVX2 static inline __m256i lowbias32_avx2(__m256i x) {
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68bu));
+    return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+}
+
+TARGET_AVX2 static int generate_avx2(const initial_state_params& params, float* positions, float* velocities,
+                                     int first, int last) {
+    const __m256i position_keys = _mm256_setr_epi32((int)params.keys[0], (int)params.keys[1], (int)params.keys[0], (int)params.keys[1],
+                                                    (int)params.keys[0], (int)params.keys[1], (int)params.keys[0], (int)params.keys[1]);
+    const __m256i velocity_keys = _mm256_setr_epi32((int)params.keys[2], (int)params.keys[3], (int)params.keys[2], (int)params.keys[3],
+                                                    (int)params.keys[2], (int)params.keys[3], (int)params.keys[2], (int)params.keys[3]);
+    const __m256 position_scale = _mm256_setr_ps(params.position_scale_x, params.position_scale_y,
+                                                 params.position_scale_x, params.position_scale_y,
+                                                 params.position_scale_x, params.position_scale_y,
+                                                 params.position_scale_x, params.position_scale_y);
+    const __m256 velocity_scale = _mm256_set1_ps(params.velocity_scale);
+    const __m256i half = _mm256_set1_epi32(8388608);
+    const __m256i lanes = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+
+    int i = first;
+    for (; i + 4 <= last; i += 4) {
+        __m256i h = lowbias32_avx2(_mm256_add_epi32(_mm256_set1_epi32(i), lanes));
+        __m256i p = _mm256_srli_epi32(lowbias32_avx2(_mm256_xor_si256(h, position_keys)), 8);
+        __m256i v = _mm256_srli_epi32(lowbias32_avx2(_mm256_xor_si256(h, velocity_keys)), 8);
+        _mm256_storeu_ps(positions + 2 * i, _mm256_mul_ps(_mm256_cvtepi32_ps(p), position_scale));
+        _mm256_storeu_ps(velocities + 2 * i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(v, half)), velocity_scale));
+    }
+    return i;
+}
+
+// the maskz forms with every lane set, gcc warns about the undefined
+// pass-through operand of the unmasked ones
+static const __mmask16 all_lanes = 0xffff;
+
+TARGET_AVX512 static inline __m512i lowbias32_avx512(__m512i x) {
+    x = _mm512_xor_si512(x, _mm512_maskz_srli_epi32(all_lanes, x, 16));
+    x = _mm512_mullo_epi32(x, _mm512_set1_epi32(0x7feb352d));
+    x = _mm512_xor_si512(x, _mm512_maskz_srli_epi32(all_lanes, x, 15));
+    x = _mm512_mullo_epi32(x, _mm512_set1_epi32((int)0x846ca68bu));
+    return _mm512_xor_si512(x, _mm512_maskz_srli_epi32(all_lanes, x, 16));
+}
+
+TARGET_AVX512 static int generate_avx512(const initial_state_params& params, float* positions, float* velocities,
+                                         int first, int last) {
+    // even lanes are x, odd lanes y
+    const __mmask16 odd = 0xaaaa;
+    const __m512i position_keys = _mm512_mask_set1_epi32(_mm512_set1_epi32((int)params.keys[0]), odd, (int)params.keys[1]);
+    const __m512i velocity_keys = _mm512_mask_set1_epi32(_mm512_set1_epi32((int)params.keys[2]), odd, (int)params.keys[3]);
+    const __m512 position_scale = _mm512_mask_mov_ps(_mm512_set1_ps(params.position_scale_x), odd,
+                                                     _mm512_set1_ps(params.position_scale_y));
+    const __m512 velocity_scale = _mm512_set1_ps(params.velocity_scale);
+    const __m512i half = _mm512_set1_epi32(8388608);
+    const __m512i lanes = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+
+    int i = first;
+    for (; i + 8 <= last; i += 8) {
+        __m512i h = lowbias32_avx512(_mm512_add_epi32(_mm512_set1_epi32(i), lanes));
+        __m512i p = _mm512_maskz_srli_epi32(all_lanes, lowbias32_avx512(_mm512_xor_si512(h, position_keys)), 8);
+        __m512i v = _mm512_maskz_srli_epi32(all_lanes, lowbias32_avx512(_mm512_xor_si512(h, velocity_keys)), 8);
+        _mm512_storeu_ps(positions + 2 * i, _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(all_lanes, p), position_scale));
+        _mm512_storeu_ps(velocities + 2 * i, _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(all_lanes, _mm512_sub_epi32(v, half)), velocity_scale));
+    }
+    return i;
+}
+
+#endif  // PARTICLES_X86_64
+
+void initial_state_generate(cpu_isa isa, const initial_state_params& params,
+                            float* positions, float* velocities, int first, int last) {
+    if (!cpu_isa_supported(isa)) isa = cpu_isa_detect();
+
+    // the simd loops stop at a multiple of their width, the scalar loop
+    // finishes the tail
+    int done = first;
+    switch (isa) {
+#ifdef PARTICLES_X86_64
+        case CPU_ISA_SSE2:
+            done = generate_sse2(params, positions, velocities, first, last);
+            break;
+        case CPU_ISA_AVX2:
+            done = generate_avx2(params, positions, velocities, first, last);
+            break;
+        case CPU_ISA_AVX512:
+            done = generate_avx512(params, positions, velocities, first, last);
+            break;
+#endif
+        default:
+            break;
+    }
+    generate_scalar(params, positions, velocities, done, last);
+}
@@ -0,0 +1,39 @@
+#ifndef PARTICLES_INITIAL_STATE_H_
+#define PARTICLES_INITIAL_STATE_H_
+
+#include <cstdint>
+
+#include "cpu_kernel.h"
+
+// counter based initial state, cpu side of init_vert_shader. particle i
+// only depends on i and the seed, never on what was generated before it,
+// so any range can be generated on its own, in any order, on the gpu or
+// on the cpu:
+//
+//     h = lowbias32(i)
+//     r = lowbias32(h ^ key[c]) >> 8      one 24 bit draw per component c
+//     position = r * canvas_size / 2^24                 in [0, canvas_size)
+//     velocity = (r - 2^23) * max_speed / 2^23          in [-max_speed, max_speed)
+//
+// the draws convert to float exactly and the scales are powers of two
+// apart from the canvas size, so each value is a single rounded multiply:
+// the same bits on every isa path and on any gpu (glsl es requires highp
+// multiplies to be correctly rounded, and there is nothing to fuse).
+
+struct initial_state_params {
+    uint32_t keys[4];        // x, y, vx, vy streams
+    float position_scale_x;  // canvas_width / 2^24
+    float position_scale_y;
+    float velocity_scale;    // max_speed / 2^23
+};
+
+void initial_state_setup(initial_state_params* params, uint32_t seed,
+                         float canvas_width, float canvas_height, float max_speed);
+
+// fills particles [first, last) of the interleaved xy streams, indexed
+// from the start of the arrays. falls back to the widest supported path
+// if isa is not supported by this cpu
+void initial_state_generate(cpu_isa isa, const initial_state_params& params,
+                            float* positions, float* velocities, int first, int last);
+
+#endif  // PARTICLES_INITIAL_STATE_H_
@@ -0,0 +1,260 @@
+#include "interaction.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PARTICLES_X86_64 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+bool interaction_grid_setup(interaction_grid* grid, float radius, float width, float height, int count) {
+    float smaller = width < height ? width : height;
+    if (!(radius > 0.0f) || radius * 3.0f > smaller) return false;
+
+    // cells at least radius wide, so the neighbours of a cell cover radius
+    grid->cols = (int)(width / radius);
+    grid->rows = (int)(height / radius);
+    grid->cell_scale_x = grid->cols / width;
+    grid->cell_scale_y = grid->rows / height;
+    grid->width = width;
+    grid->height = height;
+    grid->cell_start.assign((size_t)grid->cols * grid->rows + 1, 0);
+    grid->order.resize(count);
+    grid->xs.resize(count);
+    grid->ys.resize(count);
+    grid->cells.resize(count);
+    return true;
+}
+
+void interaction_grid_build(interaction_grid* grid, const float* positions, int count) {
+    int num_cells = grid->cols * grid->rows;
+    std::vector<uint32_t>& start = grid->cell_start;
+    std::fill(start.begin(), start.end(), 0);
+
+    for (int i = 0; i < count; i++) {
+        int cx = interaction_cell(positions[2 * i + 0], grid->cell_scale_x, grid->cols);
+        int cy = interaction_cell(positions[2 * i + 1], grid->cell_scale_y, grid->rows);
+        uint32_t cell = (uint32_t)(cy * grid->cols + cx);
+        grid->cells[i] = cell;
+        start[cell + 1]++;
+    }
+    for (int c = 0; c < num_cells; c++) start[c + 1] += start[c];
+
+    // scatter with a running cursor per cell, cell_start[c] ends up where
+    // cell_start[c + 1] was, so shift it back afterwards
+    for (int i = 0; i < count; i++) {
+        uint32_t dst = start[grid->cells[i]]++;
+        grid->order[dst] = (uint32_t)i;
+        grid->xs[dst] = positions[2 * i + 0];
+        grid->ys[dst] = positions[2 * i + 1];
+    }
+    for (int c = num_cells; c > 0; c--) start[c] = start[c - 1];
+    start[0] = 0;
+}
+
+float interaction_gain(float radius, float strength) {
+    return strength / radius * interaction_fixed_scale;
+}
+
+// one particle against a run of candidates, (sx, sy) moves the candidates
+// next to it across a wrapped edge
+struct pair_args {
+    float x, y;
+    float sx, sy;
+    float inv_radius_sq;
+    float gain;
+};
+
+static void accumulate_scalar(const float* xs, const float* ys, int first, int last, const pair_args& a,
+                              int32_t* ax, int32_t* ay) {
+    for (int j = first; j < last; j++) {
+        float dx = a.x - (xs[j] + a.sx);
+        float dy = a.y - (ys[j] + a.sy);
+        float d2 = dx * dx + dy * dy;
+        float w = 1.0f - d2 * a.inv_radius_sq;
+        if (w > 0.0f) {
+            float t = w * a.gain;
+            // round half to even, glsl's roundEven
+            *ax += (int32_t)nearbyintf(dx * t);
+            *ay += (int32_t)nearbyintf(dy * t);
+        }
+    }
+}
+
+#ifdef PARTICLES_X86_64
+
+// the simd paths stop at a multiple of their width and return where, the
+// conversions round half to even like nearbyintf
+static int accumulate_sse2(const float* xs, const float* ys, int first, int last, const pair_args& a,
+                           int32_t* ax, int32_t* ay) {
+    const __m128 x = _mm_set1_ps(a.x), y = _mm_set1_ps(a.y);
+    const __m128 sx = _mm_set1_ps(a.sx), sy = _mm_set1_ps(a.sy);
+    const __m128 inv_r2 = _mm_set1_ps(a.inv_radius_sq), gain = _mm_set1_ps(a.gain);
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    __m128i acc_x = _mm_setzero_si128(), acc_y = _mm_setzero_si128();
+
+    int j = first;
+    for (; j + 4 <= last; j += 4) {
+        __m128 dx = _mm_sub_ps(x, _mm_add_ps(_mm_loadu_ps(xs + j), sx));
+        __m128 dy = _mm_sub_ps(y, _mm_add_ps(_mm_loadu_ps(ys + j), sy));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 w = _mm_sub_ps(one, _mm_mul_ps(d2, inv_r2));
+        __m128i near = _mm_castps_si128(_mm_cmpgt_ps(w, zero));
+        __m128 t = _mm_mul_ps(w, gain);
+        acc_x = _mm_add_epi32(acc_x, _mm_and_si128(near, _mm_cvtps_epi32(_mm_mul_ps(dx, t))));
+        acc_y = _mm_add_epi32(acc_y, _mm_and_si128(near, _mm_cvtps_epi32(_mm_mul_ps(dy, t))));
+    }
+
+    alignas(16) int32_t lanes_x[4], lanes_y[4];
+    _mm_store_si128((__m128i*)lanes_x, acc_x);
+    _mm_store_si128((__m128i*)lanes_y, acc_y);
+    for (int k = 0; k < 4; k++) {
+        *ax += lanes_x[k];
+        *ay += lanes_y[k];
+    }
+    return j;
+}
+
+TARGET_AVX2 static int accumulate_avx2(const float* xs, const float* ys, int first, int last, const pair_args& a,
+                                       int32_t* ax, int32_t* ay) {
+    const __m256 x = _mm256_set1_ps(a.x), y = _mm256_set1_ps(a.y);
+    const __m256 sx = _mm256_set1_ps(a.sx), sy = _mm256_set1_ps(a.sy);
+    const __m256 inv_r2 = _mm256_set1_ps(a.inv_radius_sq), gain = _mm256_set1_ps(a.gain);
+    const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+    __m256i acc_x = _mm256_setzero_si256(), acc_y = _mm256_setzero_si256();
+
+    int j = first;
+    for (; j + 8 <= last; j += 8) {
+        __m256 dx = _mm256_sub_ps(x, _mm256_add_ps(_mm256_loadu_ps(xs + j), sx));
+        __m256 dy = _mm256_sub_ps(y, _mm256_add_ps(_mm256_loadu_ps(ys + j), sy));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 w = _mm256_sub_ps(one, _mm256_mul_ps(d2, inv_r2));
+        __m256i near = _mm256_castps_si256(_mm256_cmp_ps(w, zero, _CMP_GT_OQ));
+        __m256 t = _mm256_mul_ps(w, gain);
+        acc_x = _mm256_add_epi32(acc_x, _mm256_and_si256(near, _mm256_cvtps_epi32(_mm256_mul_ps(dx, t))));
+        acc_y = _mm256_add_epi32(acc_y, _mm256_and_si256(near, _mm256_cvtps_epi32(_mm256_mul_ps(dy, t))));
+    }
+
+    alignas(32) int32_t lanes_x[8], lanes_y[8];
+    _mm256_store_si256((__m256i*)lanes_x, acc_x);
+    _mm256_store_si256((__m256i*)lanes_y, acc_y);
+    for (int k = 0; k < 8; k++) {
+        *ax += lanes_x[k];
+        *ay += lanes_y[k];
+    }
+    return j;
+}
+
+// the tail is masked rather than left to the scalar loop, runs are short
+TARGET_AVX512 static int accumulate_avx512(const float* xs, const float* ys, int first, int last, const pair_args& a,
+                                           int32_t* ax, int32_t* ay) {
+    const __m512 x = _mm512_set1_ps(a.x), y = _mm512_set1_ps(a.y);
+    const __m512 sx = _mm512_set1_ps(a.sx), sy = _mm512_set1_ps(a.sy);
+    const __m512 inv_r2 = _mm512_set1_ps(a.inv_radius_sq), gain = _mm512_set1_ps(a.gain);
+    const __m512 one = _mm512_set1_ps(1.0f), zero = _mm512_setzero_ps();
+    __m512i acc_x = _mm512_setzero_si512(), acc_y = _mm512_setzero_si512();
+
+    for (int j = first; j < last; j += 16) {
+        __mmask16 valid = last - j >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (last - j)) - 1);
+        __m512 dx = _mm512_sub_ps(x, _mm512_add_ps(_mm512_maskz_loadu_ps(valid, xs + j), sx));
+        __m512 dy = _mm512_sub_ps(y, _mm512_add_ps(_mm512_maskz_loadu_ps(valid, ys + j), sy));
+        __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        __m512 w = _mm512_sub_ps(one, _mm512_mul_ps(d2, inv_r2));
+        __mmask16 near = _mm512_mask_cmp_ps_mask(valid, w, zero, _CMP_GT_OQ);
+        __m512 t = _mm512_mul_ps(w, gain);
+        acc_x = _mm512_add_epi32(acc_x, _mm512_maskz_cvtps_epi32(near, _mm512_mul_ps(dx, t)));
+        acc_y = _mm512_add_epi32(acc_y, _mm512_maskz_cvtps_epi32(near, _mm512_mul_ps(dy, t)));
+    }
+
+    alignas(64) int32_t lanes_x[16], lanes_y[16];
+    _mm512_store_si512(lanes_x, acc_x);
+    _mm512_store_si512(lanes_y, acc_y);
+    for (int k = 0; k < 16; k++) {
+        *ax += lanes_x[k];
+        *ay += lanes_y[k];
+    }
+    return last;
+}
+
+#endif  // PARTICLES_X86_64
+
+typedef int (*accumulate_fn)(const float*, const float*, int, int, const pair_args&, int32_t*, int32_t*);
+
+static void accumulate(accumulate_fn simd, const interaction_grid& grid, int first, int last, const pair_args& a,
+                       int32_t* ax, int32_t* ay) {
+    int done = simd ? simd(grid.xs.data(), grid.ys.data(), first, last, a, ax, ay) : first;
+    accumulate_scalar(grid.xs.data(), grid.ys.data(), done, last, a, ax, ay);
+}
+
+void interaction_accelerate(cpu_isa isa, const interaction_grid& grid, float radius, float strength,
+                            float delta_time, float* velocities, int first, int last) {
+    if (!cpu_isa_supported(isa)) isa = cpu_isa_detect();
+    accumulate_fn simd = nullptr;
+#ifdef PARTICLES_X86_64
+    switch (isa) {
+        case CPU_ISA_SSE2: simd = accumulate_sse2; break;
+        case CPU_ISA_AVX2: simd = accumulate_avx2; break;
+        case CPU_ISA_AVX512: simd = accumulate_avx512; break;
+        default: break;
+    }
+#endif
+
+    pair_args a;
+    a.inv_radius_sq = 1.0f / (radius * radius);
+    a.gain = interaction_gain(radius, strength);
+    const uint32_t* start = grid.cell_start.data();
+
+    for (int k = first; k < last; k++) {
+        a.x = grid.xs[k];
+        a.y = grid.ys[k];
+        int cx = interaction_cell(a.x, grid.cell_scale_x, grid.cols);
+        int cy = interaction_cell(a.y, grid.cell_scale_y, grid.rows);
+
+        int32_t ax = 0, ay = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            int row = cy + dy;
+            a.sy = 0.0f;
+            if (row < 0) {
+                row += grid.rows;
+                a.sy = -grid.height;
+            } else if (row >= grid.rows) {
+                row -= grid.rows;
+                a.sy = grid.height;
+            }
+            const uint32_t* row_start = start + (size_t)row * grid.cols;
+
+            if (cx > 0 && cx + 1 < grid.cols) {
+                // three cells in a row are one run of the sorted arrays
+                a.sx = 0.0f;
+                accumulate(simd, grid, (int)row_start[cx - 1], (int)row_start[cx + 2], a, &ax, &ay);
+                continue;
+            }
+            for (int dx = -1; dx <= 1; dx++) {
+                int col = cx + dx;
+                a.sx = 0.0f;
+                if (col < 0) {
+                    col += grid.cols;
+                    a.sx = -grid.width;
+                } else if (col >= grid.cols) {
+                    col -= grid.cols;
+                    a.sx = grid.width;
+                }
+                accumulate(simd, grid, (int)row_start[col], (int)row_start[col + 1], a, &ax, &ay);
+            }
+        }
+
+        // same evaluation order as the shader
+        uint32_t i = grid.order[k];
+        velocities[2 * i + 0] += (float)ax * (1.0f / interaction_fixed_scale) * delta_time;
+        velocities[2 * i + 1] += (float)ay * (1.0f / interaction_fixed_scale) * delta_time;
+    }
+}
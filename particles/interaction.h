@@ -0,0 +1,60 @@
+#ifndef PARTICLES_INTERACTION_H_
+#define PARTICLES_INTERACTION_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu_kernel.h"
+
+// short range repulsion between particles (--interact), cpu side of the
+// interaction compute shaders. every step the particles are counting
+// sorted into a uniform grid of cells at least radius wide, then each one
+// is pushed away from the others within radius in its own and the eight
+// neighbouring cells (wrapping around the canvas edges):
+//
+//     w = 1 - |d|^2 / radius^2
+//     a += d * w * strength / radius      for w > 0, d = own - other position
+//
+// each pair term is rounded to 1 / interaction_fixed_scale and summed as an
+// integer, so the sum is the same in any order: the gpu's atomic order, the
+// simd lanes and the threads all agree. velocity += a * delta_time, then
+// the position moves as in cpu_update_positions.
+
+const float interaction_fixed_scale = 256.0f;
+
+struct interaction_grid {
+    int cols;
+    int rows;
+    float cell_scale_x;                 // cells per pixel
+    float cell_scale_y;
+    float width;
+    float height;
+    std::vector<uint32_t> cell_start;   // particles of cell c are [cell_start[c], cell_start[c + 1])
+    std::vector<uint32_t> order;        // particle at each sorted index
+    std::vector<float> xs;              // positions in sorted order
+    std::vector<float> ys;
+    std::vector<uint32_t> cells;        // cell of every particle, scratch of the build
+};
+
+// sizes the grid for the canvas and count particles. false if the radius is
+// not in (0, a third of the smaller canvas side], neighbours would repeat
+bool interaction_grid_setup(interaction_grid* grid, float radius, float width, float height, int count);
+
+// cell index of one axis, same rounding as cell_of in the shaders
+inline int interaction_cell(float position, float cell_scale, int cells) {
+    int cell = (int)(position * cell_scale);
+    return cell < 0 ? 0 : (cell >= cells ? cells - 1 : cell);
+}
+
+// counting sort of the interleaved positions into the grid
+void interaction_grid_build(interaction_grid* grid, const float* positions, int count);
+
+// strength / radius in fixed point units, the factor of the pair term
+float interaction_gain(float radius, float strength);
+
+// updates the velocities of the particles at sorted indices [first, last),
+// reading positions from the grid only, so ranges can run in parallel
+void interaction_accelerate(cpu_isa isa, const interaction_grid& grid, float radius, float strength,
+                            float delta_time, float* velocities, int first, int last);
+
+#endif  // PARTICLES_INTERACTION_H_
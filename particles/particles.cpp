@@ -0,0 +1,4007 @@
+#include "particles.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.h"
+#include "initial_state.h"
+#include "interaction.h"
+#include "program_cache.h"
+#include "record_layout.h"
+#include "shader_watch.h"
+#include "snapshot.h"
+#include "spatial_sort.h"
+#include "splat.h"
+#include "spsc_ring.h"
+#include "thread_pool.h"
+
+// shader sources from gl-snippets.md
+const char* update_vert_shader = R"(#version 300 es
+in vec2 old_position;
+#ifndef PROCEDURAL_VELOCITY
+in vec2 velocity;
+#endif
+
+uniform float delta_time;
+uniform vec2 canvas_size;
+uniform int substeps;
+
+out vec2 new_position;
+
+vec2 euclidean_modulo(vec2 n, vec2 m) {
+    return mod(mod(n, m) + m, m);
+}
+
+void main() {
+#ifdef PROCEDURAL_VELOCITY
+    vec2 velocity = procedural_velocity(uint(gl_VertexID));
+#endif
+    vec2 position = old_position;
+    for (int i = 0; i < substeps; i++) {
+        position = euclidean_modulo(
+            position + velocity * delta_time,
+            canvas_size);
+    }
+    new_position = position;
+}
+)";
+
+// --systems: one pass updates every system in the pool. the particles of
+// system s are the s-th run of per_system in the buffers (the last one
+// takes the remainder), its bounds and time scale come from the uniform
+// block. the array size is max_systems
+const char* update_systems_vert_shader = R"(#version 300 es
+in vec2 old_position;
+in vec2 velocity;
+
+uniform float delta_time;
+uniform int substeps;
+uniform int per_system;
+uniform int num_systems;
+
+layout(std140) uniform systems_block {
+    vec4 bounds[512];  // origin in xy, size in zw
+    vec4 params[512];  // time scale in x
+};
+
+out vec2 new_position;
+
+vec2 euclidean_modulo(vec2 n, vec2 m) {
+    return mod(mod(n, m) + m, m);
+}
+
+void main() {
+    int s = min(gl_VertexID / per_system, num_systems - 1);
+    vec2 origin = bounds[s].xy;
+    vec2 size = bounds[s].zw;
+    float dt = delta_time * params[s].x;
+    vec2 position = old_position - origin;
+    for (int i = 0; i < substeps; i++) {
+        position = euclidean_modulo(
+            position + velocity * dt,
+            size);
+    }
+    new_position = origin + position;
+}
+)";
+
+// in place update for BACKEND_COMPUTE, LOCAL_SIZE is prepended at runtime.
+// the storage blocks are bound per chunk, so indices start at 0
+const char* update_comp_shader = R"(
+layout(local_size_x = LOCAL_SIZE) in;
+
+layout(std430, binding = 0) buffer positions_block {
+    vec2 positions[];
+};
+#ifdef PROCEDURAL_VELOCITY
+uniform uint base;  // index of the first particle in the bound range
+#else
+layout(std430, binding = 1) readonly buffer velocities_block {
+    vec2 velocities[];
+};
+#endif
+
+uniform float delta_time;
+uniform vec2 canvas_size;
+uniform uint count;
+uniform int substeps;
+
+vec2 euclidean_modulo(vec2 n, vec2 m) {
+    return mod(mod(n, m) + m, m);
+}
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count) return;
+    vec2 position = positions[i];
+#ifdef PROCEDURAL_VELOCITY
+    vec2 velocity = procedural_velocity(base + i);
+#else
+    vec2 velocity = velocities[i];
+#endif
+    for (int k = 0; k < substeps; k++) {
+        position = euclidean_modulo(
+            position + velocity * delta_time,
+            canvas_size);
+    }
+    positions[i] = position;
+}
+)";
+
+// lowbias32, the integer hash behind every random stream on the gpu: the
+// initial state, the emitter's spawns, procedural velocities and particle
+// sizes. the same as initial_state.cpp's, so the cpu can reproduce them.
+// inserted ahead of the shaders that use it, see vertex_source and
+// compute_source
+const char* lowbias32_shader = R"(
+uint lowbias32(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+)";
+
+// emission mode (--lifetime), compute only. particles live in two sets of
+// storage buffers, every frame the survivors of one set and the newly
+// spawned particles are appended to the other through an atomic counter
+// that doubles as the indirect draw command, so the live count never
+// leaves the gpu. LOCAL_SIZE is prepended at runtime
+const char* emitter_common_shader = R"(
+layout(local_size_x = LOCAL_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer src_positions_block {
+    vec2 src_positions[];
+};
+layout(std430, binding = 1) readonly buffer src_states_block {
+    vec4 src_states[];  // velocity, age
+};
+layout(std430, binding = 2) writeonly buffer dst_positions_block {
+    vec2 dst_positions[];
+};
+layout(std430, binding = 3) writeonly buffer dst_states_block {
+    vec4 dst_states[];
+};
+// DrawArraysIndirectCommand followed by the append counter
+layout(std430, binding = 4) buffer counters_block {
+    uint draw_count;
+    uint instance_count;
+    uint first;
+    uint reserved;
+    uint alive;
+};
+
+uniform uint base;  // dispatches are split by the group count limit
+)";
+
+const char* emitter_update_shader = R"(
+uniform float delta_time;
+uniform vec2 canvas_size;
+uniform int substeps;
+uniform float lifetime;
+
+vec2 euclidean_modulo(vec2 n, vec2 m) {
+    return mod(mod(n, m) + m, m);
+}
+
+void main() {
+    uint i = base + gl_GlobalInvocationID.x;
+    if (i >= draw_count) return;
+
+    vec4 state = src_states[i];
+    float age = state.z + delta_time * float(substeps);
+    if (age >= lifetime) return;
+
+    vec2 position = src_positions[i];
+    for (int k = 0; k < substeps; k++) {
+        position = euclidean_modulo(
+            position + state.xy * delta_time,
+            canvas_size);
+    }
+
+    uint j = atomicAdd(alive, 1u);
+    dst_positions[j] = position;
+    dst_states[j] = vec4(state.xy, age, 0.0);
+}
+)";
+
+const char* emitter_spawn_shader = R"(
+uniform uint spawn_count;
+uniform uint spawn_serial;  // particles spawned before this frame, seeds the rng
+uniform uint capacity;
+uniform vec2 emitter;
+
+float rand01(uint x) {
+    return float(lowbias32(x) >> 8) * (1.0 / 16777216.0);
+}
+
+void main() {
+    uint i = base + gl_GlobalInvocationID.x;
+    if (i >= spawn_count) return;
+
+    // a full buffer drops the rest of this frame's spawns
+    uint j = atomicAdd(alive, 1u);
+    if (j >= capacity) return;
+
+    uint serial = spawn_serial + i;
+    float angle = rand01(2u * serial) * 6.28318531;
+    float speed = rand01(2u * serial + 1u) * 300.0;
+    dst_positions[j] = emitter;
+    dst_states[j] = vec4(cos(angle) * speed, sin(angle) * speed, 0.0, 0.0);
+}
+)";
+
+// turns the append counter into the draw command and resets it
+const char* emitter_finish_shader = R"(
+uniform uint capacity;
+
+void main() {
+    draw_count = min(alive, capacity);
+    instance_count = 1u;
+    first = 0u;
+    reserved = 0u;
+    alive = 0u;
+}
+)";
+
+// interaction mode (--interact), compute only, see interaction.h for the
+// math. every step runs clear, count, scan, scatter and interact: the
+// particles are counting sorted into grid cells through atomic counters,
+// then each one sums the pair terms over its own and the neighbouring
+// cells. each pass only uses the blocks it needs, at most four.
+// LOCAL_SIZE is prepended at runtime
+const char* interact_common_shader = R"(
+layout(local_size_x = LOCAL_SIZE) in;
+
+layout(std430, binding = 0) buffer positions_block {
+    vec2 positions[];
+};
+layout(std430, binding = 1) buffer velocities_block {
+    vec2 velocities[];
+};
+layout(std430, binding = 2) buffer cell_counts_block {
+    uint cell_counts[];
+};
+layout(std430, binding = 3) buffer cell_start_block {
+    uint cell_start[];  // cells + 1 entries
+};
+layout(std430, binding = 4) buffer particle_cells_block {
+    uvec2 particle_cells[];  // cell and rank within it
+};
+layout(std430, binding = 5) buffer sorted_block {
+    vec2 sorted_positions[];
+};
+
+uniform uint base;
+uniform uint count;      // particles, cells for clear and scan
+uniform ivec2 grid_size;
+uniform vec2 cell_scale;
+
+ivec2 cell_of(vec2 p) {
+    return clamp(ivec2(p * cell_scale), ivec2(0), grid_size - 1);
+}
+)";
+
+const char* interact_clear_shader = R"(
+void main() {
+    uint c = base + gl_GlobalInvocationID.x;
+    if (c >= count) return;
+    cell_counts[c] = 0u;
+}
+)";
+
+const char* interact_count_shader = R"(
+void main() {
+    uint i = base + gl_GlobalInvocationID.x;
+    if (i >= count) return;
+    ivec2 cell = cell_of(positions[i]);
+    uint c = uint(cell.y * grid_size.x + cell.x);
+    particle_cells[i] = uvec2(c, atomicAdd(cell_counts[c], 1u));
+}
+)";
+
+// one work group: every invocation sums a slice of the cells, the slice
+// totals are scanned in shared memory, then the slices are written out
+const char* interact_scan_shader = R"(
+shared uint slice_start[LOCAL_SIZE];
+
+void main() {
+    uint t = gl_LocalInvocationID.x;
+    uint per_slice = (count + uint(LOCAL_SIZE) - 1u) / uint(LOCAL_SIZE);
+    uint first = min(t * per_slice, count);
+    uint last = min(first + per_slice, count);
+
+    uint sum = 0u;
+    for (uint c = first; c < last; c++) sum += cell_counts[c];
+    slice_start[t] = sum;
+    barrier();
+    if (t == 0u) {
+        uint total = 0u;
+        for (int k = 0; k < LOCAL_SIZE; k++) {
+            uint n = slice_start[k];
+            slice_start[k] = total;
+            total += n;
+        }
+        cell_start[count] = total;
+    }
+    barrier();
+
+    uint start = slice_start[t];
+    for (uint c = first; c < last; c++) {
+        cell_start[c] = start;
+        start += cell_counts[c];
+    }
+}
+)";
+
+const char* interact_scatter_shader = R"(
+void main() {
+    uint i = base + gl_GlobalInvocationID.x;
+    if (i >= count) return;
+    uvec2 cell = particle_cells[i];
+    sorted_positions[cell_start[cell.x] + cell.y] = positions[i];
+}
+)";
+
+const char* interact_shader = R"(
+uniform float delta_time;
+uniform vec2 canvas_size;
+uniform float inv_radius_sq;
+uniform float gain;
+uniform float inv_fixed_scale;
+
+vec2 euclidean_modulo(vec2 n, vec2 m) {
+    return mod(mod(n, m) + m, m);
+}
+
+void main() {
+    uint i = base + gl_GlobalInvocationID.x;
+    if (i >= count) return;
+    vec2 position = positions[i];
+    ivec2 cell = cell_of(position);
+
+    ivec2 acc = ivec2(0);
+    for (int dy = -1; dy <= 1; dy++) {
+        int row = cell.y + dy;
+        float shift_y = 0.0;
+        if (row < 0) {
+            row += grid_size.y;
+            shift_y = -canvas_size.y;
+        } else if (row >= grid_size.y) {
+            row -= grid_size.y;
+            shift_y = canvas_size.y;
+        }
+        for (int dx = -1; dx <= 1; dx++) {
+            int col = cell.x + dx;
+            float shift_x = 0.0;
+            if (col < 0) {
+                col += grid_size.x;
+                shift_x = -canvas_size.x;
+            } else if (col >= grid_size.x) {
+                col -= grid_size.x;
+                shift_x = canvas_size.x;
+            }
+            uint c = uint(row * grid_size.x + col);
+            for (uint k = cell_start[c]; k < cell_start[c + 1u]; k++) {
+                vec2 d = position - (sorted_positions[k] + vec2(shift_x, shift_y));
+                float d2 = d.x * d.x + d.y * d.y;
+                float w = 1.0 - d2 * inv_radius_sq;
+                if (w > 0.0) acc += ivec2(roundEven(d * (w * gain)));
+            }
+        }
+    }
+
+    vec2 velocity = velocities[i] + vec2(acc) * inv_fixed_scale * delta_time;
+    velocities[i] = velocity;
+    positions[i] = euclidean_modulo(position + velocity * delta_time, canvas_size);
+}
+)";
+
+// fixed point updates (FORMAT_FIXED32, FORMAT_FIXED16), positions are
+// fractions of the canvas and wrap by integer overflow, so there is no
+// mod(). position_scale is fixed point units per pixel. the rounded step
+// is the same every substep, so substeps of them are one multiply
+const char* update_fixed32_vert_shader = R"(#version 300 es
+in uvec2 old_position;
+#ifndef PROCEDURAL_VELOCITY
+in vec2 velocity;
+#endif
+
+uniform float delta_time;
+uniform vec2 position_scale;
+uniform int substeps;
+
+flat out uvec2 new_position;
+
+const float max_step = 2147483520.0;
+
+void main() {
+#ifdef PROCEDURAL_VELOCITY
+    vec2 velocity = procedural_velocity(uint(gl_VertexID));
+#endif
+    vec2 step = floor(velocity * delta_time * position_scale + 0.5);
+    new_position = old_position + uint(substeps) * uvec2(ivec2(clamp(step, -max_step, max_step)));
+}
+)";
+
+const char* update_fixed16_vert_shader = R"(#version 300 es
+in uint old_position;  // x in the low half, y in the high half
+#ifndef PROCEDURAL_VELOCITY
+in vec2 velocity;
+#endif
+
+uniform float delta_time;
+uniform vec2 position_scale;
+uniform int substeps;
+
+flat out uint new_position;
+
+const float max_step = 2147483520.0;
+
+void main() {
+#ifdef PROCEDURAL_VELOCITY
+    vec2 velocity = procedural_velocity(uint(gl_VertexID));
+#endif
+    vec2 step = floor(velocity * delta_time * position_scale + 0.5);
+    uvec2 moved = uvec2(old_position & 0xffffu, old_position >> 16)
+                + uint(substeps) * uvec2(ivec2(clamp(step, -max_step, max_step)));
+    new_position = (moved.x & 0xffffu) | (moved.y << 16);
+}
+)";
+
+// --record: the position step of update_vert_shader plus the age, the
+// constant fields are copied through for the interleaved layout (and not
+// captured in the separate one)
+const char* update_record_vert_shader = R"(#version 300 es
+in vec2 position;
+in vec2 velocity;
+in vec4 color;
+in float age;
+
+uniform float delta_time;
+uniform vec2 canvas_size;
+uniform int substeps;
+
+out vec2 new_position;
+out vec2 new_velocity;
+out vec4 new_color;
+out float new_age;
+
+vec2 euclidean_modulo(vec2 n, vec2 m) {
+    return mod(mod(n, m) + m, m);
+}
+
+void main() {
+    vec2 p = position;
+    float a = age;
+    for (int i = 0; i < substeps; i++) {
+        p = euclidean_modulo(
+            p + velocity * delta_time,
+            canvas_size);
+        a += delta_time;
+    }
+    new_position = p;
+    new_velocity = velocity;
+    new_color = color;
+    new_age = a;
+}
+)";
+
+// initial state (INIT_GPU), see initial_state.h. drawn without attributes,
+// both outputs go to their own buffer. needs lowbias32_shader
+const char* init_vert_shader = R"(#version 300 es
+uniform uvec4 keys;
+uniform vec2 position_scale;
+uniform float velocity_scale;
+
+out vec2 new_position;
+out vec2 new_velocity;
+
+void main() {
+    uint h = lowbias32(uint(gl_VertexID));
+    uvec4 r = uvec4(lowbias32(h ^ keys.x), lowbias32(h ^ keys.y), lowbias32(h ^ keys.z), lowbias32(h ^ keys.w)) >> 8u;
+    new_position = vec2(r.xy) * position_scale;
+    new_velocity = vec2(ivec2(r.zw) - 8388608) * velocity_scale;
+}
+)";
+
+// --velocity procedural: velocities never change without --interact, so
+// each one is the velocity the particle started with, recomputed from its
+// index with init_vert_shader's hash and scale instead of fetched. inserted
+// after the #version line of the update shaders, behind lowbias32_shader
+const char* procedural_velocity_shader = R"(
+#define PROCEDURAL_VELOCITY
+uniform uvec2 velocity_keys;
+uniform float velocity_scale;
+
+vec2 procedural_velocity(uint index) {
+    uint h = lowbias32(index);
+    uvec2 r = uvec2(lowbias32(h ^ velocity_keys.x), lowbias32(h ^ velocity_keys.y)) >> 8u;
+    return vec2(ivec2(r) - 8388608) * velocity_scale;
+}
+)";
+
+const char* update_frag_shader = R"(#version 300 es
+precision highp float;
+void main() {
+}
+)";
+
+const char* render_vert_shader = R"(#version 300 es
+in vec2 position;
+uniform mat4 mvp;
+
+void main() {
+    gl_Position = mvp * vec4(position, 0.0, 1.0);
+    gl_PointSize = 2.0;
+}
+)";
+
+const char* render_frag_shader = R"(#version 300 es
+precision highp float;
+out vec4 frag_color;
+
+void main() {
+    frag_color = vec4(1.0, 0.0, 0.0, 1.0);
+}
+)";
+
+// --record: the particle's own color, pulsing once per second of age
+const char* render_record_vert_shader = R"(#version 300 es
+in vec2 position;
+in vec4 color;
+in float age;
+uniform mat4 mvp;
+
+out vec4 particle_color;
+
+void main() {
+    gl_Position = mvp * vec4(position, 0.0, 1.0);
+    gl_PointSize = 2.0;
+    particle_color = vec4(color.rgb * (0.75 + 0.25 * cos(age * 6.2831853)), color.a);
+}
+)";
+
+const char* render_record_frag_shader = R"(#version 300 es
+precision highp float;
+in vec4 particle_color;
+out vec4 frag_color;
+
+void main() {
+    frag_color = particle_color;
+}
+)";
+
+// --render sized-points|instanced|pulled: every particle gets its own size
+// in [1, --max-size] pixels, hashed from its index like procedural_velocity,
+// so there is no size buffer and the three paths agree. inserted after the
+// #version line, behind lowbias32_shader
+const char* particle_size_shader = R"(
+uniform uint size_key;
+uniform float size_scale;   // (max_size - 1) / 2^24
+
+float particle_size(uint index) {
+    return 1.0 + float(lowbias32(index ^ size_key) >> 8) * size_scale;
+}
+)";
+
+// one point per particle, gl_PointSize up to the driver's limit. base is
+// the first vertex of the drawn buffer's particles (the upload slot)
+const char* render_sized_vert_shader = R"(#version 300 es
+in vec2 position;
+uniform mat4 mvp;
+uniform int base;
+
+void main() {
+    gl_Position = mvp * vec4(position, 0.0, 1.0);
+    gl_PointSize = particle_size(uint(gl_VertexID - base));
+}
+)";
+
+// a triangle strip quad per instance, the position advances once per
+// instance. instances count from 0 in every draw, first is the draw's
+// first particle
+const char* render_instanced_vert_shader = R"(#version 300 es
+in vec2 position;
+uniform mat4 mvp;
+uniform vec2 pixel_size;    // of the viewport, in clip space
+uniform int first;
+
+void main() {
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) - 0.5;
+    float size = particle_size(uint(first + gl_InstanceID));
+    gl_Position = mvp * vec4(position, 0.0, 1.0) + vec4(corner * size * pixel_size, 0.0, 0.0);
+}
+)";
+
+// vertex pulling: six vertices per particle and no attributes, the
+// position is fetched from a storage buffer bound as in splat_comp_shader
+const char* render_pulled_vert_shader = R"(#version 310 es
+layout(std430, binding = 0) readonly buffer positions_block {
+    vec2 positions[];
+};
+
+uniform mat4 mvp;
+uniform vec2 pixel_size;
+uniform uint skip;
+uniform int first;
+
+const vec2 corners[6] = vec2[6](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(0.0, 1.0),
+                                vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0));
+
+void main() {
+    int i = gl_VertexID / 6;
+    vec2 corner = corners[gl_VertexID - 6 * i] - 0.5;
+    float size = particle_size(uint(first + i));
+    gl_Position = mvp * vec4(positions[skip + uint(i)], 0.0, 1.0) + vec4(corner * size * pixel_size, 0.0, 0.0);
+}
+)";
+
+// --render splat, see splat.h. every particle adds one to the cells of its
+// 2x2 footprint, rows top down. the positions are bound from the dispatch's
+// first particle rounded down to the storage offset alignment, skip is the
+// distance to it. LOCAL_SIZE is prepended at runtime
+const char* splat_comp_shader = R"(
+layout(local_size_x = LOCAL_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer positions_block {
+    vec2 positions[];
+};
+layout(std430, binding = 1) buffer counts_block {
+    uint counts[];
+};
+
+uniform uint skip;
+uniform uint count;
+uniform ivec2 canvas_size;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= count) return;
+    // positions are on the canvas, truncating is floor(p - 0.5)
+    ivec2 corner = ivec2(positions[skip + i] + 0.5) - 1;
+    for (int y = corner.y; y < corner.y + 2; y++) {
+        for (int x = corner.x; x < corner.x + 2; x++) {
+            if (uint(x) < uint(canvas_size.x) && uint(y) < uint(canvas_size.y)) {
+                atomicAdd(counts[y * canvas_size.x + x], 1u);
+            }
+        }
+    }
+}
+)";
+
+// one invocation per pixel: the point or the clear color into the image,
+// and the count zeroed for the next frame
+const char* splat_resolve_shader = R"(
+layout(local_size_x = LOCAL_SIZE, local_size_y = LOCAL_SIZE) in;
+
+layout(std430, binding = 1) buffer counts_block {
+    uint counts[];
+};
+layout(rgba8, binding = 0) writeonly uniform highp image2D image;
+
+uniform ivec2 canvas_size;
+
+void main() {
+    ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(p, canvas_size))) return;
+    int i = p.y * canvas_size.x + p.x;
+    imageStore(image, p, counts[i] != 0u ? vec4(1.0, 0.0, 0.0, 1.0) : vec4(0.1, 0.1, 0.1, 1.0));
+    counts[i] = 0u;
+}
+)";
+
+// BACKEND_THREADS: frames the cpu may run ahead of the gpu, and particles
+// per task (~400 KB of position, velocity and output, about one L2)
+const int upload_slots = 3;
+const int cpu_task_particles = 16384;
+
+// upper bound of --ring, position buffers the updates rotate through
+const int max_ring_slots = 8;
+
+// --snapshot: copy buffers in flight, and the bytes in front of the
+// positions in each (the particle count, copied on the gpu with --lifetime)
+const int snapshot_slots = 3;
+const GLintptr snapshot_prefix = 16;
+
+// --systems: upper bound, the std140 arrays of update_systems_vert_shader
+// fill the 16 KB every driver allows for a uniform block
+const int max_systems = 512;
+
+// --interact: work group size of the cell scan, the minimum every ES 3.1
+// driver supports
+const int scan_local_size = 128;
+
+// --render splat: work group size of the splat pass, and the side of the
+// square groups of the resolve
+const int splat_local_size = 256;
+const int resolve_local_size = 8;
+
+// --render-thread: frames the caller may queue ahead of the render thread.
+// two let it build one while the other is drawn, more only add latency
+const size_t render_queue_frames = 2;
+
+// passes wrapped in timer queries, and how many frames of queries are in
+// flight before a result is read back
+enum timer_pass { PASS_UPDATE, PASS_RENDER, num_timer_passes };
+const int timer_frames = 4;
+
+// a program to build, a vertex and a fragment shader with optional
+// transform feedback varyings, or a compute shader alone
+struct program_source {
+    std::string vs;
+    std::string fs;
+    std::string cs;
+    std::vector<const char*> varyings;
+    GLenum buffer_mode;
+};
+
+// a program whose compile and link were issued, see submit_program
+struct submitted_program {
+    uint64_t key;       // program_key of its source
+    GLuint prog;
+    bool cached;        // loaded from --program-cache
+};
+
+// --shader-dir: the shaders of the programs that reload, each in the file
+// of its name plus .glsl
+struct editable_shader {
+    const char* name;
+    const char* builtin;
+};
+
+const editable_shader editable_shaders[] = {
+    { "update_vert_shader", update_vert_shader },
+    { "update_fixed32_vert_shader", update_fixed32_vert_shader },
+    { "update_fixed16_vert_shader", update_fixed16_vert_shader },
+    { "update_systems_vert_shader", update_systems_vert_shader },
+    { "update_record_vert_shader", update_record_vert_shader },
+    { "update_frag_shader", update_frag_shader },
+    { "update_comp_shader", update_comp_shader },
+    { "procedural_velocity_shader", procedural_velocity_shader },
+    { "render_vert_shader", render_vert_shader },
+    { "render_frag_shader", render_frag_shader },
+    { "render_record_vert_shader", render_record_vert_shader },
+    { "render_record_frag_shader", render_record_frag_shader },
+    { "render_sized_vert_shader", render_sized_vert_shader },
+    { "render_instanced_vert_shader", render_instanced_vert_shader },
+    { "render_pulled_vert_shader", render_pulled_vert_shader },
+    { "particle_size_shader", particle_size_shader },
+};
+const int num_editable_shaders = sizeof(editable_shaders) / sizeof(editable_shaders[0]);
+
+// a program --shader-dir rebuilds when one of its shaders changes
+struct reloadable_program {
+    const char* name;
+    GLuint* slot;                                     // the program in use
+    program_source (*source)(const particle_options& opts);
+    void (*bind)();                                   // its locations and constant uniforms
+    GLuint built;                                     // latest program built for the slot
+    std::string text;                                 // and its sources
+};
+
+// built by a reload, swapped into slot at the next frame
+struct reloaded_program {
+    const char* name;
+    GLuint* slot;
+    GLuint prog;
+    void (*bind)();
+};
+
+// a frame for the render thread
+struct frame_packet {
+    double frame_time;  // for render_frame
+    bool stop;          // no frame, the render thread releases the context and ends
+};
+
+// global state
+struct {
+    int num_particles;
+    int chunk_size;
+    sim_backend backend;
+    position_format format;
+    bool procedural_velocity;   // no velocity buffer, see procedural_velocity_shader
+    struct {
+        cpu_isa isa;
+        std::vector<float> positions;   // simulation state of BACKEND_CPU
+        std::vector<float> velocities;
+        std::unique_ptr<thread_pool> pool;  // BACKEND_THREADS and the reorder pass
+    } cpu;
+    struct {
+        const char* source;     // sim_stats::init
+        uint32_t seed;
+        double seconds;         // generating (or restoring) the state, upload included
+        int mismatches;         // --validate with INIT_GPU: particles unlike the cpu's, -1 if not checked
+    } init;
+    struct {
+        bool enabled;           // --lifetime > 0
+        float lifetime;
+        double rate;            // spawns per second
+        double pending;         // fraction of a spawn carried to the next frame
+        long long spawned;      // spawn requests so far, seeds the rng
+        GLuint states[2];       // velocity and age per particle, pairs with buffers.pos
+        GLuint counters;        // draw command + append counter
+        GLuint update_prog;
+        GLuint spawn_prog;
+        GLuint finish_prog;
+        int max_dispatch;       // invocations per dispatch
+    } emitter;
+    struct {
+        int count;                  // 1 without --systems
+        int per_system;             // particles per system, the last one takes the remainder
+        std::vector<float> bounds;  // origin and size per system
+        std::vector<float> time_scales;
+        std::vector<GLint> firsts;  // draw ranges
+        std::vector<GLsizei> counts;
+        GLuint ubo;                 // systems_block
+        GLint per_system_location;
+        GLint num_systems_location;
+    } systems;
+    struct {
+        bool enabled;           // --interact > 0
+        float radius;
+        float strength;
+        interaction_grid grid;  // cpu backends: the grid itself, compute: its size
+        GLuint cell_counts;
+        GLuint cell_start;
+        GLuint particle_cells;
+        GLuint sorted_positions;
+        GLuint clear_prog;
+        GLuint count_prog;
+        GLuint scan_prog;
+        GLuint scatter_prog;
+        GLuint interact_prog;
+        int max_dispatch;       // invocations per dispatch
+    } interaction;
+    struct {
+        double step;        // fixed timestep in seconds, 0 = one update per frame
+        int max_substeps;
+        double accumulator; // frame time not simulated yet
+        double time;        // simulated seconds
+        long long steps;
+        int most_substeps;  // largest batch run in one frame
+        double dropped;     // seconds skipped because a frame was over max_substeps
+    } clock;
+    render_mode render;
+    struct {
+        const char* cache_dir;  // --program-cache, null without
+        int count;              // programs created
+        int cache_hits;         // loaded from a cached binary
+        int rejected;           // cached binaries the driver refused, compiled again
+        double seconds;         // submitting them and waiting for them
+        bool parallel;          // KHR_parallel_shader_compile, with threads
+        int ready;              // programs complete by the time they were needed
+        std::vector<submitted_program> submitted;  // ahead of create_program, see submit_programs
+    } programs;
+    struct {
+        particle_options opts;  // the sources of the programs depend on them
+        std::string texts[num_editable_shaders];  // of the files, empty for the builtin shader
+        std::vector<reloadable_program> programs;
+        shader_watch watch;
+        bool watching;
+        void (*make_current)(bool current);  // shared context, null without
+        std::thread thread;     // builds the reloads with the shared context
+        int reloads;            // programs swapped in
+        std::mutex mutex;       // guards the fields below
+        std::vector<reloaded_program> pending;
+        int failures;           // reloads that did not compile or link
+        std::atomic<bool> has_pending;
+    } reload;
+    struct {
+        void (*make_current)(bool current);
+        void (*present)();
+        std::thread thread;     // draws the frames while it runs, see start_render_thread
+        bool ran;               // since the last reset_sim_stats
+        spsc_ring<frame_packet, render_queue_frames> queue;
+        int submit_waits;       // caller side
+        int render_waits;       // render thread side, read once it is joined
+        state_cache_counters state_calls;  // of the render thread, the shadow is per thread
+    } render_thread;
+    struct {
+        float max_size;         // variable sizes, see particle_size_shader
+        float point_size_limit; // GL_ALIASED_POINT_SIZE_RANGE
+        int max_pull;           // RENDER_PULLED: particles per draw, within the storage block size
+        int align_particles;    // storage offset alignment, in particles
+        GLuint vao;             // RENDER_PULLED: no attributes
+    } sizes;
+    struct {
+        GLuint image;           // resolved rgba8 canvas, rows top down
+        GLuint framebuffer;     // reads the image for the blit
+        GLuint counts;          // RENDER_SPLAT: uint per pixel, zeroed by the resolve
+        GLuint splat_prog;
+        GLuint resolve_prog;
+        int max_dispatch;       // particles per dispatch
+        int align_particles;    // storage offset alignment, in particles
+        std::vector<uint32_t> cpu_counts;  // RENDER_SPLAT_CPU
+        std::vector<uint32_t> pixels;
+    } splat;
+    struct {
+        int every;      // frames between sorts, 0 = never
+        int frames;     // frames since the last sort
+        int passes;
+        double seconds;
+    } reorder;
+    struct {
+        GLuint buffer;                 // upload_slots * num_particles positions
+        GLuint render_vao;
+        float* mapped;                 // persistent mapping, null when mapped per frame
+        GLsync fences[upload_slots];   // signaled once the slot's draw is done
+        int slot;
+        int stalls;
+        int map_failures;              // frames uploaded with glBufferSubData instead
+        bool map_failed;               // reported, once per run
+    } upload;
+    struct {
+        std::unique_ptr<snapshot_writer> writer;  // null without --snapshot
+        int every;
+        long long frame;                   // render_frame calls so far
+        GLuint buffers[snapshot_slots];    // prefix + one copy of the positions each
+        GLsync fences[snapshot_slots];     // set while the copy is in flight
+        long long frames[snapshot_slots];  // frame and sim time of the copy
+        double times[snapshot_slots];
+        int next;                          // slot the next copy goes to, the oldest in flight
+        int dropped;
+    } snapshots;
+    struct {
+        bool enabled;           // EXT_disjoint_timer_query
+        GLuint queries[timer_frames][num_timer_passes];
+        bool pending[timer_frames];
+        int slot;               // ring slot of the current frame
+        bool active;            // current frame is timed on the gpu
+        int timed_frames;
+        int dropped_frames;     // slot still in flight, or the results were disjoint
+        double gpu_ms[num_timer_passes];   // sums over timed frames
+        double cpu_ms[num_timer_passes];   // sums over all frames
+        int cpu_frames;
+        std::chrono::steady_clock::time_point cpu_start;
+    } timers;
+    GLuint update_prog;
+    GLuint render_prog;
+    struct {
+        GLuint prog;            // BACKEND_COMPUTE
+        int workgroup_size;
+        int max_dispatch;       // particles per dispatch, within the group count limit
+    } compute;
+    struct {
+        GLuint pos[max_ring_slots];  // ring of position buffers
+        GLuint vel;                  // velocity buffer
+    } buffers;
+    struct {
+        GLuint update[max_ring_slots];  // for updating positions, reads pos[i]
+        GLuint render[max_ring_slots];  // for rendering particles
+    } vaos;
+    struct {
+        GLuint tf[max_ring_slots];  // transform feedback objects
+        int num_outputs;            // buffers the update captures into, see update_tf
+        const GLuint* outputs[num_record_fields];  // ring of buffers of each
+        GLsizeiptr strides[num_record_fields];
+    } tfs;
+    struct {
+        record_layout layout;       // mode RECORD_NONE without --record
+        GLuint buffers[num_record_fields][max_ring_slots];  // of each stream, constant ones only use
+                                                            // [0]. the position stream is buffers.pos,
+                                                            // a separate velocity stream buffers.vel
+    } records;
+    struct {
+        int slots;                      // position buffers in use, 1 for BACKEND_COMPUTE
+        int read;                       // slot holding the latest positions
+        GLsync fences[max_ring_slots];  // signaled once the slot's draw is done
+        int stalls;
+    } ring;
+} g_state;
+
+// the update of a frame reads ring.read and writes (and draws) the next slot
+int ring_write_slot() {
+    return (g_state.ring.read + 1) % g_state.ring.slots;
+}
+
+// uniform/attribute locations
+struct {
+    struct {
+        GLint old_position;
+        GLint velocity;
+        GLint delta_time;
+        GLint canvas_size;
+        GLint position_scale;
+        GLint substeps;
+    } update;
+    struct {
+        GLint position;
+        GLint mvp;
+        GLint base;
+        GLint first;
+        GLint skip;
+    } render;
+    struct {
+        GLint delta_time;
+        GLint canvas_size;
+        GLint count;
+        GLint substeps;
+        GLint base;
+    } compute;
+    struct {
+        GLint update_base;
+        GLint delta_time;
+        GLint canvas_size;
+        GLint substeps;
+        GLint lifetime;
+        GLint spawn_base;
+        GLint spawn_count;
+        GLint spawn_serial;
+        GLint spawn_capacity;
+        GLint emitter;
+        GLint finish_capacity;
+    } emitter;
+    struct {
+        GLint skip;
+        GLint count;
+    } splat;
+    struct {
+        GLint clear_base;
+        GLint count_base;
+        GLint scatter_base;
+        GLint interact_base;
+        GLint delta_time;
+    } interaction;
+} g_locs;
+
+const char* sim_backend_name(sim_backend backend) {
+    switch (backend) {
+        case BACKEND_AUTO: return "auto";
+        case BACKEND_COMPUTE: return "compute";
+        case BACKEND_CPU: return "cpu";
+        case BACKEND_THREADS: return "threads";
+        default: return "tf";
+    }
+}
+
+const char* position_format_name(position_format format) {
+    switch (format) {
+        case FORMAT_FIXED32: return "fixed32";
+        case FORMAT_FIXED16: return "fixed16";
+        default: return "float";
+    }
+}
+
+const char* render_mode_name(render_mode mode) {
+    switch (mode) {
+        case RENDER_SIZED_POINTS: return "sized-points";
+        case RENDER_INSTANCED: return "instanced";
+        case RENDER_PULLED: return "pulled";
+        case RENDER_SPLAT: return "splat";
+        case RENDER_SPLAT_CPU: return "splat-cpu";
+        default: return "points";
+    }
+}
+
+// bytes of one particle's position in the gpu buffers
+GLsizeiptr position_size(position_format format) {
+    return format == FORMAT_FIXED16 ? sizeof(uint32_t) : 2 * sizeof(uint32_t);
+}
+
+int position_bits(position_format format) {
+    return format == FORMAT_FIXED16 ? 16 : 32;
+}
+
+void print_usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--particles <n>] [--chunk <n>]"
+              << " [--backend auto|tf|compute|cpu|threads] [--workgroup <n>] [--format float|fixed32|fixed16] [--ring <n>] [--threads <n>] [--reorder <n>] [--cpu-isa scalar|sse2|avx2|avx512|auto] [--validate]"
+              << " [--step <seconds>] [--max-substeps <n>]"
+              << " [--lifetime <seconds>] [--emit <per second>] [--interact <radius>] [--strength <n>]"
+              << " [--systems <n>] [--snapshot <file>] [--snapshot-every <n>] [--checkpoint <file>] [--restore <file>]"
+              << " [--init auto|gpu|cpu] [--seed <n>] [--velocity buffer|procedural] [--record none|separate|interleaved]"
+              << " [--render points|sized-points|instanced|pulled|splat|splat-cpu] [--max-size <pixels>]"
+              << " [--program-cache <dir>] [--compile-threads <n>] [--shader-dir <dir>] [--state-cache on|off]"
+              << " [--render-thread] [--bench] [--frames <n>] [--warmup <n>] [--dt <seconds>] [--app-work <ms>]" << std::endl;
+}
+
+bool parse_options(int argc, char** argv, particle_options* opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(arg, "--particles") == 0 && value) {
+            opts->num_particles = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--chunk") == 0 && value) {
+            opts->chunk_size = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--backend") == 0 && value) {
+            if (strcmp(value, "auto") == 0) opts->backend = BACKEND_AUTO;
+            else if (strcmp(value, "tf") == 0) opts->backend = BACKEND_TF;
+            else if (strcmp(value, "compute") == 0) opts->backend = BACKEND_COMPUTE;
+            else if (strcmp(value, "cpu") == 0) opts->backend = BACKEND_CPU;
+            else if (strcmp(value, "threads") == 0) opts->backend = BACKEND_THREADS;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--workgroup") == 0 && value) {
+            opts->workgroup_size = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--format") == 0 && value) {
+            if (strcmp(value, "float") == 0) opts->format = FORMAT_FLOAT;
+            else if (strcmp(value, "fixed32") == 0) opts->format = FORMAT_FIXED32;
+            else if (strcmp(value, "fixed16") == 0) opts->format = FORMAT_FIXED16;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--ring") == 0 && value) {
+            opts->ring_slots = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--threads") == 0 && value) {
+            opts->threads = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--reorder") == 0 && value) {
+            opts->reorder_every = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--cpu-isa") == 0 && value) {
+            if (!cpu_isa_parse(value, &opts->isa)) {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--validate") == 0) {
+            opts->validate = true;
+        } else if (strcmp(arg, "--render-thread") == 0) {
+            opts->render_thread = true;
+        } else if (strcmp(arg, "--bench") == 0) {
+            opts->bench = true;
+        } else if (strcmp(arg, "--frames") == 0 && value) {
+            opts->bench_frames = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--warmup") == 0 && value) {
+            opts->bench_warmup = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--dt") == 0 && value) {
+            opts->bench_delta_time = atof(value);
+            i++;
+        } else if (strcmp(arg, "--app-work") == 0 && value) {
+            opts->bench_app_ms = atof(value);
+            i++;
+        } else if (strcmp(arg, "--step") == 0 && value) {
+            opts->step = atof(value);
+            i++;
+        } else if (strcmp(arg, "--lifetime") == 0 && value) {
+            opts->lifetime = atof(value);
+            i++;
+        } else if (strcmp(arg, "--emit") == 0 && value) {
+            opts->emit_rate = atof(value);
+            i++;
+        } else if (strcmp(arg, "--snapshot") == 0 && value) {
+            opts->snapshot_path = value;
+            i++;
+        } else if (strcmp(arg, "--snapshot-every") == 0 && value) {
+            opts->snapshot_every = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--systems") == 0 && value) {
+            opts->systems = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--interact") == 0 && value) {
+            opts->interact_radius = (float)atof(value);
+            i++;
+        } else if (strcmp(arg, "--strength") == 0 && value) {
+            opts->interact_strength = (float)atof(value);
+            i++;
+        } else if (strcmp(arg, "--checkpoint") == 0 && value) {
+            opts->checkpoint_path = value;
+            i++;
+        } else if (strcmp(arg, "--restore") == 0 && value) {
+            opts->restore_path = value;
+            i++;
+        } else if (strcmp(arg, "--init") == 0 && value) {
+            if (strcmp(value, "auto") == 0) opts->init = INIT_AUTO;
+            else if (strcmp(value, "gpu") == 0) opts->init = INIT_GPU;
+            else if (strcmp(value, "cpu") == 0) opts->init = INIT_CPU;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--record") == 0 && value) {
+            if (strcmp(value, "none") == 0) opts->record = RECORD_NONE;
+            else if (strcmp(value, "separate") == 0) opts->record = RECORD_SEPARATE;
+            else if (strcmp(value, "interleaved") == 0) opts->record = RECORD_INTERLEAVED;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--render") == 0 && value) {
+            if (strcmp(value, "points") == 0) opts->render = RENDER_POINTS;
+            else if (strcmp(value, "sized-points") == 0) opts->render = RENDER_SIZED_POINTS;
+            else if (strcmp(value, "instanced") == 0) opts->render = RENDER_INSTANCED;
+            else if (strcmp(value, "pulled") == 0) opts->render = RENDER_PULLED;
+            else if (strcmp(value, "splat") == 0) opts->render = RENDER_SPLAT;
+            else if (strcmp(value, "splat-cpu") == 0) opts->render = RENDER_SPLAT_CPU;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--program-cache") == 0 && value) {
+            opts->program_cache_dir = value;
+            i++;
+        } else if (strcmp(arg, "--state-cache") == 0 && value) {
+            if (strcmp(value, "on") == 0) opts->state_cache = true;
+            else if (strcmp(value, "off") == 0) opts->state_cache = false;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--shader-dir") == 0 && value) {
+            opts->shader_dir = value;
+            i++;
+        } else if (strcmp(arg, "--compile-threads") == 0 && value) {
+            opts->compile_threads = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--max-size") == 0 && value) {
+            opts->max_size = (float)atof(value);
+            i++;
+        } else if (strcmp(arg, "--velocity") == 0 && value) {
+            if (strcmp(value, "buffer") == 0) opts->procedural_velocity = false;
+            else if (strcmp(value, "procedural") == 0) opts->procedural_velocity = true;
+            else {
+                print_usage(argv[0]);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--seed") == 0 && value) {
+            opts->seed = (uint32_t)strtoul(value, nullptr, 0);
+            i++;
+        } else if (strcmp(arg, "--max-substeps") == 0 && value) {
+            opts->max_substeps = atoi(value);
+            i++;
+        } else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (opts->num_particles <= 0 || opts->num_particles > max_particles) {
+        std::cerr << "--particles must be in [1, " << max_particles << "]" << std::endl;
+        return false;
+    }
+    if (opts->chunk_size <= 0 || opts->threads < 0 || opts->workgroup_size <= 0 ||
+        opts->reorder_every < 0 || opts->snapshot_every <= 0 || opts->interact_radius < 0.0f || opts->compile_threads < -1 ||
+        !(opts->max_size >= 1.0f)) {
+        print_usage(argv[0]);
+        return false;
+    }
+    if (opts->systems < 1 || opts->systems > max_systems) {
+        std::cerr << "--systems must be in [1, " << max_systems << "]" << std::endl;
+        return false;
+    }
+    if (opts->ring_slots < 2 || opts->ring_slots > max_ring_slots) {
+        std::cerr << "--ring must be in [2, " << max_ring_slots << "]" << std::endl;
+        return false;
+    }
+    if (opts->bench_frames <= 0 || opts->bench_warmup < 0 || opts->bench_delta_time < 0.0 || opts->bench_app_ms < 0.0 ||
+        opts->step < 0.0 || opts->max_substeps <= 0 || opts->lifetime < 0.0 || opts->emit_rate < 0.0) {
+        print_usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+// helper functions
+
+// splitmix64, seeds the time scale of each system
+uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// xorshift64*, uniform float in [min, max)
+float rand_float(uint64_t* state, float min, float max) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    float scale = (uint32_t)((x * 0x2545f4914f6cdd1dull) >> 40) * (1.0f / 16777216.0f);
+    return min + scale * (max - min);
+}
+
+// initial velocities are in [-init_max_speed, init_max_speed) pixels / s.
+// threads take blocks of particles off a counter, a particle's state only
+// depends on its index so the split does not matter
+const float init_max_speed = 300.0f;
+const int init_block_size = 1 << 16;
+
+initial_state_params init_params() {
+    initial_state_params params;
+    initial_state_setup(&params, g_state.init.seed, window_width, window_height, init_max_speed);
+    return params;
+}
+
+void init_particles(float* positions, float* velocities, int count) {
+    int num_blocks = (count + init_block_size - 1) / init_block_size;
+    std::atomic<int> next_block(0);
+    initial_state_params params = init_params();
+
+    auto worker = [&]() {
+        for (int block = next_block++; block < num_blocks; block = next_block++) {
+            int first = block * init_block_size;
+            int last = first + init_block_size < count ? first + init_block_size : count;
+            initial_state_generate(g_state.cpu.isa, params, positions, velocities, first, last);
+        }
+    };
+
+    int num_threads = (int)std::thread::hardware_concurrency();
+    if (num_threads > num_blocks) num_threads = num_blocks;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) t.join();
+}
+
+// converts float positions into a fixed point position buffer
+void encode_positions(const float* positions, uint32_t* out, int count, position_format format) {
+    int bits = position_bits(format);
+    for (int i = 0; i < count; i++) {
+        uint32_t x = fixed_encode(positions[2 * i + 0], window_width, bits);
+        uint32_t y = fixed_encode(positions[2 * i + 1], window_height, bits);
+        if (format == FORMAT_FIXED16) {
+            out[i] = x | (y << 16);
+        } else {
+            out[2 * i + 0] = x;
+            out[2 * i + 1] = y;
+        }
+    }
+}
+
+// position of particle i in pixels, whatever the format
+void decode_position(const void* positions, int i, position_format format, float* x, float* y) {
+    if (format == FORMAT_FLOAT) {
+        *x = ((const float*)positions)[2 * i + 0];
+        *y = ((const float*)positions)[2 * i + 1];
+    } else if (format == FORMAT_FIXED16) {
+        uint32_t packed = ((const uint32_t*)positions)[i];
+        *x = fixed_decode(packed & 0xffff, window_width, 16);
+        *y = fixed_decode(packed >> 16, window_height, 16);
+    } else {
+        *x = fixed_decode(((const uint32_t*)positions)[2 * i + 0], window_width, 32);
+        *y = fixed_decode(((const uint32_t*)positions)[2 * i + 1], window_height, 32);
+    }
+}
+
+bool check_shader_errors(GLuint shader) {
+    GLint success;
+    GLchar info_log[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, 512, NULL, info_log);
+        std::cerr << "shader compilation error:\n" << info_log << std::endl;
+        return false;
+    }
+    return true;
+}
+
+program_source vertex_program(std::string vs, std::string fs, std::vector<const char*> varyings = {},
+                              GLenum buffer_mode = GL_SEPARATE_ATTRIBS) {
+    return { vs, fs, "", varyings, buffer_mode };
+}
+
+program_source compute_program(std::string cs) {
+    return { "", "", cs, {}, GL_SEPARATE_ATTRIBS };
+}
+
+// the key of a program for --program-cache and the submitted programs: its
+// sources and the driver's strings
+uint64_t program_key(const program_source& source) {
+    std::vector<std::string> parts = { source.vs, source.fs, source.cs, std::to_string(source.buffer_mode) };
+    for (const char* varying : source.varyings) parts.push_back(varying);
+    parts.push_back((const char*)glGetString(GL_VENDOR));
+    parts.push_back((const char*)glGetString(GL_RENDERER));
+    parts.push_back((const char*)glGetString(GL_VERSION));
+    return program_cache_key(parts);
+}
+
+// links prog from the cached binary of key. false on a miss, or if the
+// driver rejects the binary (after a driver update that kept its version
+// string, say), its entry is dropped then
+bool load_program_binary(GLuint prog, uint64_t key) {
+    uint32_t format;
+    std::vector<char> binary;
+    if (!program_cache_load(g_state.programs.cache_dir, key, &format, &binary)) return false;
+    glProgramBinary(prog, format, binary.data(), (GLsizei)binary.size());
+    GLint linked;
+    glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        g_state.programs.rejected++;
+        program_cache_remove(g_state.programs.cache_dir, key);
+        return false;
+    }
+    g_state.programs.cache_hits++;
+    return true;
+}
+
+void store_program_binary(GLuint prog, uint64_t key) {
+    GLint size;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return;
+    std::vector<char> binary(size);
+    GLsizei length;
+    GLenum format;
+    glGetProgramBinary(prog, size, &length, &format, binary.data());
+    program_cache_store(g_state.programs.cache_dir, key, format, binary.data(), length);
+}
+
+GLuint compile_shader(GLenum type, const std::string& source) {
+    const char* text = source.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &text, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+// attaches the shaders of source to prog and links it, without reading
+// back the status. attributes_of, if set, is a program whose attribute
+// locations prog keeps, so vertex arrays set up for it still fit
+void link_program(GLuint prog, const program_source& source, GLuint attributes_of = 0) {
+    bool compute = !source.cs.empty();
+    GLuint shaders[2] = {
+        compile_shader(compute ? GL_COMPUTE_SHADER : GL_VERTEX_SHADER, compute ? source.cs : source.vs),
+        compute ? 0 : compile_shader(GL_FRAGMENT_SHADER, source.fs),
+    };
+    for (GLuint shader : shaders) {
+        if (!shader) continue;
+        glAttachShader(prog, shader);
+        // freed with the program, the compile log stays readable until then
+        glDeleteShader(shader);
+    }
+    if (!source.varyings.empty()) {
+        glTransformFeedbackVaryings(prog, (GLsizei)source.varyings.size(), source.varyings.data(), source.buffer_mode);
+    }
+    GLint attributes = 0;
+    if (attributes_of) glGetProgramiv(attributes_of, GL_ACTIVE_ATTRIBUTES, &attributes);
+    for (GLint i = 0; i < attributes; i++) {
+        GLchar name[256];
+        GLint size;
+        GLenum type;
+        glGetActiveAttrib(attributes_of, i, sizeof(name), NULL, &size, &type, name);
+        GLint location = glGetAttribLocation(attributes_of, name);
+        if (location >= 0) glBindAttribLocation(prog, location, name);
+    }
+    glLinkProgram(prog);
+}
+
+// issues the compile and link of a program without reading back their
+// status, so nothing waits for the driver. with KHR_parallel_shader_compile
+// it works on every submitted program at once, finish_program collects the
+// result. programs out of --program-cache are complete right away
+submitted_program submit_program(const program_source& source) {
+    submitted_program program = { program_key(source), glCreateProgram(), false };
+    if (g_state.programs.cache_dir && load_program_binary(program.prog, program.key)) {
+        program.cached = true;
+        return program;
+    }
+    if (g_state.programs.cache_dir) {
+        glProgramParameteri(program.prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    link_program(program.prog, source);
+    return program;
+}
+
+// false after printing the compile or link errors of prog
+bool check_program_errors(GLuint prog) {
+    GLint linked;
+    glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+    if (linked) return true;
+    GLuint shaders[2];
+    GLsizei count = 0;
+    glGetAttachedShaders(prog, 2, &count, shaders);
+    bool compiled = true;
+    for (GLsizei i = 0; i < count && compiled; i++) compiled = check_shader_errors(shaders[i]);
+    if (compiled) {
+        GLchar info_log[512];
+        glGetProgramInfoLog(prog, 512, NULL, info_log);
+        std::cerr << "program link error:\n" << info_log << std::endl;
+    }
+    return false;
+}
+
+// waits for a submitted program. returns it, or 0 after printing the
+// compile or link errors
+GLuint finish_program(const submitted_program& program) {
+    GLuint prog = program.prog;
+    if (g_state.programs.parallel) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(prog, GL_COMPLETION_STATUS_KHR, &done);
+        if (done) g_state.programs.ready++;
+    }
+    if (!check_program_errors(prog)) {
+        glDeleteProgram(prog);
+        return 0;
+    }
+    if (g_state.programs.cache_dir && !program.cached) store_program_binary(prog, program.key);
+    return prog;
+}
+
+// submits a program ahead of create_program, see submit_programs
+void prefetch_program(const program_source& source) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    g_state.programs.submitted.push_back(submit_program(source));
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    g_state.programs.seconds += elapsed.count();
+}
+
+// every program is built through here: the one submitted ahead if there is
+// one, else it is submitted now. counts them and the time spent submitting
+// and waiting for them
+GLuint create_program(const program_source& source) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t key = program_key(source);
+    std::vector<submitted_program>& submitted = g_state.programs.submitted;
+    submitted_program program = { 0, 0, false };
+    for (size_t i = 0; i < submitted.size(); i++) {
+        if (submitted[i].key != key) continue;
+        program = submitted[i];
+        submitted.erase(submitted.begin() + i);
+        break;
+    }
+    if (!program.prog) program = submit_program(source);
+    GLuint prog = finish_program(program);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    g_state.programs.seconds += elapsed.count();
+    g_state.programs.count++;
+    return prog;
+}
+
+std::string compute_source(int local_size, const char* body, const std::string& common = "") {
+    return "#version 310 es\n#define LOCAL_SIZE " + std::to_string(local_size) + "\n" + common + body;
+}
+
+// a vertex shader with common code inserted after its #version line
+std::string vertex_source(const char* source, const std::string& common) {
+    const char* body = strchr(source, '\n') + 1;
+    return std::string(source, body) + common + body;
+}
+
+// --velocity procedural: the keys and scale of the particles' initial
+// velocities, the uniforms never change
+void set_velocity_uniforms(GLuint prog) {
+    initial_state_params params = init_params();
+    glUseProgram(prog);
+    glUniform2ui(glGetUniformLocation(prog, "velocity_keys"), params.keys[2], params.keys[3]);
+    glUniform1f(glGetUniformLocation(prog, "velocity_scale"), params.velocity_scale);
+}
+
+// the same velocities on the cpu, for validation and checkpoints
+std::vector<float> procedural_velocities() {
+    std::vector<float> positions((size_t)g_state.num_particles * 2);
+    std::vector<float> velocities((size_t)g_state.num_particles * 2);
+    init_particles(positions.data(), velocities.data(), g_state.num_particles);
+    return velocities;
+}
+
+// the text of one of the editable_shaders, its --shader-dir file if there
+// is one
+const char* shader_text(const char* builtin) {
+    for (int i = 0; i < num_editable_shaders; i++) {
+        if (editable_shaders[i].builtin != builtin) continue;
+        return g_state.reload.texts[i].empty() ? builtin : g_state.reload.texts[i].c_str();
+    }
+    return builtin;
+}
+
+// the sources of the programs, shared by the setup functions that build
+// them and submit_programs, which submits them ahead
+program_source update_compute_program(int workgroup_size) {
+    std::string common;
+    if (g_state.procedural_velocity) common = std::string(lowbias32_shader) + shader_text(procedural_velocity_shader);
+    return compute_program(compute_source(workgroup_size, shader_text(update_comp_shader), common));
+}
+
+// update, spawn and finish
+std::vector<program_source> emitter_programs(int wg) {
+    return {
+        compute_program(compute_source(wg, emitter_update_shader, emitter_common_shader)),
+        compute_program(compute_source(wg, emitter_spawn_shader, std::string(emitter_common_shader) + lowbias32_shader)),
+        compute_program(compute_source(1, emitter_finish_shader, emitter_common_shader)),
+    };
+}
+
+// clear, count, scan, scatter and interact
+std::vector<program_source> interaction_programs(int wg) {
+    return {
+        compute_program(compute_source(wg, interact_clear_shader, interact_common_shader)),
+        compute_program(compute_source(wg, interact_count_shader, interact_common_shader)),
+        compute_program(compute_source(scan_local_size, interact_scan_shader, interact_common_shader)),
+        compute_program(compute_source(wg, interact_scatter_shader, interact_common_shader)),
+        compute_program(compute_source(wg, interact_shader, interact_common_shader)),
+    };
+}
+
+program_source init_program() {
+    std::vector<const char*> varyings = { "new_position" };
+    if (!g_state.procedural_velocity) varyings.push_back("new_velocity");
+    return vertex_program(vertex_source(init_vert_shader, lowbias32_shader), shader_text(update_frag_shader), varyings);
+}
+
+program_source update_program(const particle_options& opts) {
+    if (opts.record != RECORD_NONE) {
+        const record_layout& layout = g_state.records.layout;
+        GLenum buffer_mode = layout.mode == RECORD_INTERLEAVED ? GL_INTERLEAVED_ATTRIBS : GL_SEPARATE_ATTRIBS;
+        return vertex_program(shader_text(update_record_vert_shader), shader_text(update_frag_shader),
+                              std::vector<const char*>(layout.outputs, layout.outputs + layout.num_outputs),
+                              buffer_mode);
+    }
+    const char* update_shaders[] = { update_vert_shader, update_fixed32_vert_shader, update_fixed16_vert_shader };
+    const char* update_shader = opts.systems > 1 ? update_systems_vert_shader : update_shaders[g_state.format];
+    update_shader = shader_text(update_shader);
+    std::string vs = update_shader;
+    if (g_state.procedural_velocity) {
+        vs = vertex_source(update_shader, std::string(lowbias32_shader) + shader_text(procedural_velocity_shader));
+    }
+    return vertex_program(vs, shader_text(update_frag_shader), { "new_position" });
+}
+
+program_source render_program(const particle_options& opts) {
+    if (opts.record != RECORD_NONE) {
+        return vertex_program(shader_text(render_record_vert_shader), shader_text(render_record_frag_shader));
+    }
+    if (opts.render == RENDER_SIZED_POINTS || opts.render == RENDER_INSTANCED || opts.render == RENDER_PULLED) {
+        // vertex pulling needs 310 es, in both stages
+        const char* sized_shaders[] = { render_sized_vert_shader, render_instanced_vert_shader, render_pulled_vert_shader };
+        std::string vs = vertex_source(shader_text(sized_shaders[opts.render - RENDER_SIZED_POINTS]),
+                                       std::string(lowbias32_shader) + shader_text(particle_size_shader));
+        std::string fs = shader_text(render_frag_shader);
+        if (opts.render == RENDER_PULLED) fs = "#version 310 es" + fs.substr(fs.find('\n'));
+        return vertex_program(vs, fs);
+    }
+    return vertex_program(shader_text(render_vert_shader), shader_text(render_frag_shader));
+}
+
+// splat and resolve
+std::vector<program_source> splat_programs() {
+    return {
+        compute_program(compute_source(splat_local_size, splat_comp_shader)),
+        compute_program(compute_source(resolve_local_size, splat_resolve_shader)),
+    };
+}
+
+// KHR_parallel_shader_compile: submits every program setup_graphics is
+// going to build, in the order it builds them, so the driver compiles them
+// all at once while setup waits for the first. the earlier validation
+// already ruled out what setup_graphics would reject
+void submit_programs(const particle_options& opts, bool gpu_init) {
+    std::vector<program_source> sources;
+    if (g_state.backend == BACKEND_COMPUTE) {
+        sources.push_back(update_compute_program(opts.workgroup_size));
+        if (g_state.emitter.enabled) {
+            std::vector<program_source> emitter = emitter_programs(opts.workgroup_size);
+            sources.insert(sources.end(), emitter.begin(), emitter.end());
+        }
+        if (g_state.interaction.enabled) {
+            std::vector<program_source> interaction = interaction_programs(opts.workgroup_size);
+            sources.insert(sources.end(), interaction.begin(), interaction.end());
+        }
+    }
+    sources.push_back(update_program(opts));
+    sources.push_back(render_program(opts));
+    if (gpu_init && !g_state.emitter.enabled && !opts.restore_path) sources.push_back(init_program());
+    if (opts.render == RENDER_SPLAT) {
+        std::vector<program_source> splat = splat_programs();
+        sources.insert(sources.end(), splat.begin(), splat.end());
+    }
+    for (const program_source& source : sources) prefetch_program(source);
+}
+
+// drops the submitted programs setup_graphics did not take: the ones of a
+// failed setup step, or the ones a later step would have used
+void release_programs() {
+    for (const submitted_program& program : g_state.programs.submitted) glDeleteProgram(program.prog);
+    g_state.programs.submitted.clear();
+}
+
+// the locations and constant uniforms of the programs --shader-dir reloads,
+// after setup and after every reload
+void bind_compute_program() {
+    GLuint prog = g_state.compute.prog;
+    if (g_state.procedural_velocity) set_velocity_uniforms(prog);
+    g_locs.compute.delta_time = glGetUniformLocation(prog, "delta_time");
+    g_locs.compute.canvas_size = glGetUniformLocation(prog, "canvas_size");
+    g_locs.compute.count = glGetUniformLocation(prog, "count");
+    g_locs.compute.substeps = glGetUniformLocation(prog, "substeps");
+    g_locs.compute.base = glGetUniformLocation(prog, "base");
+}
+
+void bind_update_program() {
+    GLuint prog = g_state.update_prog;
+    if (g_state.procedural_velocity) set_velocity_uniforms(prog);
+    g_locs.update.old_position = glGetAttribLocation(prog, "old_position");
+    g_locs.update.velocity = glGetAttribLocation(prog, "velocity");
+    g_locs.update.delta_time = glGetUniformLocation(prog, "delta_time");
+    g_locs.update.canvas_size = glGetUniformLocation(prog, "canvas_size");
+    g_locs.update.position_scale = glGetUniformLocation(prog, "position_scale");
+    g_locs.update.substeps = glGetUniformLocation(prog, "substeps");
+    if (g_state.systems.count > 1) {
+        glUniformBlockBinding(prog, glGetUniformBlockIndex(prog, "systems_block"), 0);
+        g_state.systems.per_system_location = glGetUniformLocation(prog, "per_system");
+        g_state.systems.num_systems_location = glGetUniformLocation(prog, "num_systems");
+    }
+}
+
+// with variable sizes also the size uniforms
+void bind_render_program() {
+    GLuint prog = g_state.render_prog;
+    g_locs.render.position = glGetAttribLocation(prog, "position");
+    g_locs.render.mvp = glGetUniformLocation(prog, "mvp");
+    g_locs.render.base = glGetUniformLocation(prog, "base");
+    g_locs.render.first = glGetUniformLocation(prog, "first");
+    g_locs.render.skip = glGetUniformLocation(prog, "skip");
+    if (g_state.render != RENDER_SIZED_POINTS && g_state.render != RENDER_INSTANCED && g_state.render != RENDER_PULLED) return;
+    glUseProgram(prog);
+    glUniform1ui(glGetUniformLocation(prog, "size_key"), (GLuint)splitmix64(g_state.init.seed));
+    glUniform1f(glGetUniformLocation(prog, "size_scale"), (g_state.sizes.max_size - 1.0f) / 16777216.0f);
+    glUniform2f(glGetUniformLocation(prog, "pixel_size"), 2.0f / window_width, 2.0f / window_height);
+}
+
+// --shader-dir: reads the shader files of the directory, and writes the
+// builtin text of those missing so there is something to edit. before any
+// program is built. false if the directory cannot be written
+bool setup_shader_dir(const char* dir) {
+    for (int i = 0; i < num_editable_shaders; i++) {
+        std::string path = std::string(dir) + "/" + editable_shaders[i].name + ".glsl";
+        if (read_text_file(path, &g_state.reload.texts[i])) continue;
+        if (!write_text_file(path, editable_shaders[i].builtin)) {
+            std::cerr << "failed to write " << path << ", is --shader-dir an existing directory?" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// rereads the changed files among names and rebuilds the programs whose
+// sources changed with them. runs on the reload thread with the shared
+// context, or between frames without one. a program that does not compile
+// or link is dropped, the old one stays in use
+void rebuild_programs(const std::vector<std::string>& names) {
+    bool changed = false;
+    for (const std::string& name : names) {
+        for (int i = 0; i < num_editable_shaders; i++) {
+            if (name != std::string(editable_shaders[i].name) + ".glsl") continue;
+            std::string path = std::string(g_state.reload.opts.shader_dir) + "/" + name;
+            changed = read_text_file(path, &g_state.reload.texts[i]) || changed;
+        }
+    }
+    if (!changed) return;
+
+    std::vector<reloaded_program> built;
+    int failures = 0;
+    for (reloadable_program& program : g_state.reload.programs) {
+        program_source source = program.source(g_state.reload.opts);
+        std::string text = source.vs + source.fs + source.cs;
+        if (text == program.text) continue;
+        program.text = text;
+
+        GLuint prog = glCreateProgram();
+        link_program(prog, source, program.built);
+        if (!check_program_errors(prog)) {
+            std::cerr << "keeping the old " << program.name << " program" << std::endl;
+            glDeleteProgram(prog);
+            failures++;
+            continue;
+        }
+        program.built = prog;
+        built.push_back({ program.name, program.slot, prog, program.bind });
+    }
+    // the render context may only use the programs once they are complete
+    if (!built.empty() && g_state.reload.make_current) glFinish();
+
+    std::lock_guard<std::mutex> lock(g_state.reload.mutex);
+    g_state.reload.pending.insert(g_state.reload.pending.end(), built.begin(), built.end());
+    g_state.reload.failures += failures;
+    if (!built.empty()) g_state.reload.has_pending.store(true, std::memory_order_release);
+}
+
+void reload_loop() {
+    g_state.reload.make_current(true);
+    std::vector<std::string> names;
+    while (g_state.reload.watch.changes(true, &names)) rebuild_programs(names);
+    g_state.reload.make_current(false);
+}
+
+// --shader-dir: registers the programs that reload and starts watching,
+// at the end of setup_graphics. the programs are the ones every frame
+// runs, the rest keep their builtin shaders until a restart
+void start_shader_reload(const particle_options& opts) {
+    g_state.reload.opts = opts;
+    g_state.reload.programs.clear();
+    g_state.reload.programs.push_back({ "update", &g_state.update_prog, update_program, bind_update_program,
+                                        g_state.update_prog, "" });
+    g_state.reload.programs.push_back({ "render", &g_state.render_prog, render_program, bind_render_program,
+                                        g_state.render_prog, "" });
+    if (g_state.backend == BACKEND_COMPUTE) {
+        g_state.reload.programs.push_back({ "compute", &g_state.compute.prog,
+                                            [](const particle_options& o) { return update_compute_program(o.workgroup_size); },
+                                            bind_compute_program, g_state.compute.prog, "" });
+    }
+    for (reloadable_program& program : g_state.reload.programs) {
+        program_source source = program.source(opts);
+        program.text = source.vs + source.fs + source.cs;
+    }
+
+    g_state.reload.watching = g_state.reload.watch.open(opts.shader_dir);
+    if (!g_state.reload.watching) return;
+    if (g_state.reload.make_current) g_state.reload.thread = std::thread(reload_loop);
+    std::cerr << "watching " << opts.shader_dir << " for shader changes, rebuilding "
+              << (g_state.reload.make_current ? "on a shared context" : "between frames") << std::endl;
+}
+
+// at the start of a frame: swaps in the programs rebuilt since the last
+// one. without a shared context this is also where they are rebuilt
+void apply_shader_reloads() {
+    if (!g_state.reload.watching) return;
+    if (!g_state.reload.make_current) {
+        std::vector<std::string> names;
+        if (g_state.reload.watch.changes(false, &names) && !names.empty()) rebuild_programs(names);
+    }
+    if (!g_state.reload.has_pending.load(std::memory_order_acquire)) return;
+
+    std::vector<reloaded_program> pending;
+    {
+        std::lock_guard<std::mutex> lock(g_state.reload.mutex);
+        pending.swap(g_state.reload.pending);
+        g_state.reload.has_pending.store(false, std::memory_order_relaxed);
+    }
+    for (const reloaded_program& program : pending) {
+        glDeleteProgram(*program.slot);
+        *program.slot = program.prog;
+        program.bind();
+        g_state.reload.reloads++;
+        std::cerr << "reloaded the " << program.name << " program" << std::endl;
+    }
+}
+
+// BACKEND_COMPUTE: checks the work group size against the driver, builds
+// the program for it and works out how many particles fit in one dispatch
+bool setup_compute(int workgroup_size) {
+    GLint max_size, max_invocations, max_groups, max_block_size, alignment;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_size);
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+    if (workgroup_size > max_size || workgroup_size > max_invocations) {
+        std::cerr << "work group size " << workgroup_size << " exceeds the driver limit of "
+                  << (max_size < max_invocations ? max_size : max_invocations) << std::endl;
+        return false;
+    }
+
+    g_state.compute.prog = create_program(update_compute_program(workgroup_size));
+    if (!g_state.compute.prog) return false;
+    bind_compute_program();
+
+    // one dispatch is limited by the group count and by the storage block
+    // size, and the next chunk has to start on a storage offset boundary
+    long long max_dispatch = (long long)max_groups * workgroup_size;
+    long long block_particles = max_block_size / (2 * sizeof(float));
+    if (block_particles < max_dispatch) max_dispatch = block_particles;
+    if (g_state.chunk_size < max_dispatch) max_dispatch = g_state.chunk_size;
+    int align_particles = alignment > (int)(2 * sizeof(float)) ? alignment / (int)(2 * sizeof(float)) : 1;
+    max_dispatch -= max_dispatch % align_particles;
+    if (max_dispatch <= 0) {
+        std::cerr << "--chunk is too small for the storage buffer offset alignment" << std::endl;
+        return false;
+    }
+
+    g_state.compute.workgroup_size = workgroup_size;
+    g_state.compute.max_dispatch = (int)max_dispatch;
+    return true;
+}
+
+// emission mode: programs, the particle states and the counter buffer. the
+// position buffers come from the ring, like every other backend. the
+// population starts empty
+bool setup_emitter(int capacity) {
+    int wg = g_state.compute.workgroup_size;
+    GLint max_groups, max_block_size;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+
+    // the compaction appends anywhere in the buffer, so the whole buffer is
+    // one storage block
+    if ((long long)capacity * 4 * (long long)sizeof(float) > max_block_size) {
+        std::cerr << "--lifetime supports at most " << max_block_size / (4 * sizeof(float))
+                  << " particles on this driver" << std::endl;
+        return false;
+    }
+
+    std::vector<program_source> sources = emitter_programs(wg);
+    g_state.emitter.update_prog = create_program(sources[0]);
+    g_state.emitter.spawn_prog = create_program(sources[1]);
+    g_state.emitter.finish_prog = create_program(sources[2]);
+    if (!g_state.emitter.update_prog || !g_state.emitter.spawn_prog || !g_state.emitter.finish_prog) return false;
+
+    GLuint update = g_state.emitter.update_prog;
+    g_locs.emitter.update_base = glGetUniformLocation(update, "base");
+    g_locs.emitter.delta_time = glGetUniformLocation(update, "delta_time");
+    g_locs.emitter.canvas_size = glGetUniformLocation(update, "canvas_size");
+    g_locs.emitter.substeps = glGetUniformLocation(update, "substeps");
+    g_locs.emitter.lifetime = glGetUniformLocation(update, "lifetime");
+    GLuint spawn = g_state.emitter.spawn_prog;
+    g_locs.emitter.spawn_base = glGetUniformLocation(spawn, "base");
+    g_locs.emitter.spawn_count = glGetUniformLocation(spawn, "spawn_count");
+    g_locs.emitter.spawn_serial = glGetUniformLocation(spawn, "spawn_serial");
+    g_locs.emitter.spawn_capacity = glGetUniformLocation(spawn, "capacity");
+    g_locs.emitter.emitter = glGetUniformLocation(spawn, "emitter");
+    g_locs.emitter.finish_capacity = glGetUniformLocation(g_state.emitter.finish_prog, "capacity");
+
+    glGenBuffers(2, g_state.emitter.states);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_state.emitter.states[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)capacity * 4 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+    }
+    const GLuint counters[] = { 0, 1, 0, 0, 0 };
+    glGenBuffers(1, &g_state.emitter.counters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_state.emitter.counters);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(counters), counters, GL_DYNAMIC_COPY);
+
+    g_state.emitter.max_dispatch = max_groups * wg;
+    g_state.emitter.pending = 0.0;
+    g_state.emitter.spawned = 0;
+    return true;
+}
+
+// --systems: every system gets a tile of the window, its own time scale
+// in [0.5, 1.5) and a contiguous run of the pool. the bounds and time
+// scales go into one uniform buffer that the update pass indexes
+bool setup_systems(int count) {
+    g_state.systems.count = count;
+    g_state.systems.per_system = g_state.num_particles / count;
+    if (count == 1) return true;
+
+    int cols = 1;
+    while (cols * cols * window_height < count * window_width) cols++;
+    int rows = (count + cols - 1) / cols;
+    float tile_width = (float)window_width / cols;
+    float tile_height = (float)window_height / rows;
+
+    g_state.systems.bounds.resize((size_t)count * 4);
+    g_state.systems.time_scales.resize(count);
+    g_state.systems.firsts.resize(count);
+    g_state.systems.counts.resize(count);
+    for (int i = 0; i < count; i++) {
+        float* bounds = &g_state.systems.bounds[(size_t)i * 4];
+        bounds[0] = (i % cols) * tile_width;
+        bounds[1] = (i / cols) * tile_height;
+        bounds[2] = tile_width;
+        bounds[3] = tile_height;
+        uint64_t state = splitmix64(g_state.init.seed ^ ~(uint64_t)i);
+        g_state.systems.time_scales[i] = rand_float(&state, 0.5f, 1.5f);
+        g_state.systems.firsts[i] = i * g_state.systems.per_system;
+        g_state.systems.counts[i] = i + 1 < count ? g_state.systems.per_system : g_state.num_particles - g_state.systems.firsts[i];
+    }
+
+    // std140: bounds[max_systems] then params[max_systems], a vec4 each
+    std::vector<float> block((size_t)max_systems * 8, 0.0f);
+    memcpy(block.data(), g_state.systems.bounds.data(), g_state.systems.bounds.size() * sizeof(float));
+    for (int i = 0; i < count; i++) block[((size_t)max_systems + i) * 4] = g_state.systems.time_scales[i];
+    glGenBuffers(1, &g_state.systems.ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, g_state.systems.ubo);
+    glBufferData(GL_UNIFORM_BUFFER, block.size() * sizeof(float), block.data(), GL_STATIC_DRAW);
+    return true;
+}
+
+// moves freshly generated positions (spread over the window) into the tile
+// of their system
+void place_in_systems(float* positions) {
+    if (g_state.systems.count == 1) return;
+    for (int s = 0; s < g_state.systems.count; s++) {
+        const float* bounds = &g_state.systems.bounds[(size_t)s * 4];
+        for (int i = g_state.systems.firsts[s]; i < g_state.systems.firsts[s] + g_state.systems.counts[s]; i++) {
+            positions[2 * i + 0] = bounds[0] + positions[2 * i + 0] * (bounds[2] / window_width);
+            positions[2 * i + 1] = bounds[1] + positions[2 * i + 1] * (bounds[3] / window_height);
+        }
+    }
+}
+
+// interaction mode: sizes the grid for the canvas, and for the compute
+// backend builds the programs and the grid buffers. the passes bind the
+// buffers whole, a particle's neighbours can be anywhere in them
+bool setup_interaction(float radius, float strength) {
+    interaction_grid& grid = g_state.interaction.grid;
+    bool cpu = g_state.backend != BACKEND_COMPUTE;
+    if (!interaction_grid_setup(&grid, radius, window_width, window_height, cpu ? g_state.num_particles : 0)) {
+        std::cerr << "--interact must be in (0, " << (window_width < window_height ? window_width : window_height) / 3
+                  << "]" << std::endl;
+        return false;
+    }
+    g_state.interaction.radius = radius;
+    g_state.interaction.strength = strength;
+    if (cpu) return true;
+
+    int wg = g_state.compute.workgroup_size;
+    GLint max_groups, max_block_size;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+    if ((long long)g_state.num_particles * 2 * (long long)sizeof(float) > max_block_size) {
+        std::cerr << "--interact supports at most " << max_block_size / (2 * sizeof(float))
+                  << " particles on this driver" << std::endl;
+        return false;
+    }
+
+    GLuint& clear = g_state.interaction.clear_prog;
+    GLuint& count = g_state.interaction.count_prog;
+    GLuint& scan = g_state.interaction.scan_prog;
+    GLuint& scatter = g_state.interaction.scatter_prog;
+    GLuint& interact = g_state.interaction.interact_prog;
+    std::vector<program_source> sources = interaction_programs(wg);
+    clear = create_program(sources[0]);
+    count = create_program(sources[1]);
+    scan = create_program(sources[2]);
+    scatter = create_program(sources[3]);
+    interact = create_program(sources[4]);
+    if (!clear || !count || !scan || !scatter || !interact) return false;
+
+    g_locs.interaction.clear_base = glGetUniformLocation(clear, "base");
+    g_locs.interaction.count_base = glGetUniformLocation(count, "base");
+    g_locs.interaction.scatter_base = glGetUniformLocation(scatter, "base");
+    g_locs.interaction.interact_base = glGetUniformLocation(interact, "base");
+    g_locs.interaction.delta_time = glGetUniformLocation(interact, "delta_time");
+
+    // everything but the dispatch base and the step is fixed
+    int num_cells = grid.cols * grid.rows;
+    GLuint progs[] = { clear, count, scan, scatter, interact };
+    for (GLuint prog : progs) {
+        bool per_cell = prog == clear || prog == scan;
+        glProgramUniform1ui(prog, glGetUniformLocation(prog, "count"), (GLuint)(per_cell ? num_cells : g_state.num_particles));
+        glProgramUniform2i(prog, glGetUniformLocation(prog, "grid_size"), grid.cols, grid.rows);
+        glProgramUniform2f(prog, glGetUniformLocation(prog, "cell_scale"), grid.cell_scale_x, grid.cell_scale_y);
+    }
+    glProgramUniform2f(interact, glGetUniformLocation(interact, "canvas_size"), window_width, window_height);
+    glProgramUniform1f(interact, glGetUniformLocation(interact, "inv_radius_sq"), 1.0f / (radius * radius));
+    glProgramUniform1f(interact, glGetUniformLocation(interact, "gain"), interaction_gain(radius, strength));
+    glProgramUniform1f(interact, glGetUniformLocation(interact, "inv_fixed_scale"), 1.0f / interaction_fixed_scale);
+
+    GLuint* buffers[] = { &g_state.interaction.cell_counts, &g_state.interaction.cell_start,
+                          &g_state.interaction.particle_cells, &g_state.interaction.sorted_positions };
+    GLsizeiptr sizes[] = { (GLsizeiptr)num_cells * 4, (GLsizeiptr)(num_cells + 1) * 4,
+                           (GLsizeiptr)g_state.num_particles * 8, (GLsizeiptr)g_state.num_particles * 8 };
+    for (int i = 0; i < 4; i++) {
+        glGenBuffers(1, buffers[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[i], NULL, GL_DYNAMIC_COPY);
+    }
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        std::cerr << "out of memory allocating the interaction grid" << std::endl;
+        return false;
+    }
+
+    g_state.interaction.max_dispatch = max_groups * wg;
+    return true;
+}
+
+// pass timings: the cpu side is the time to issue a pass (and to run it,
+// for the cpu backends), the gpu side comes from GL_TIME_ELAPSED queries
+// that are read back timer_frames frames later, so they never stall
+void setup_timers() {
+    memset(g_state.timers.pending, 0, sizeof(g_state.timers.pending));
+    g_state.timers.slot = 0;
+    g_state.timers.active = false;
+    g_state.timers.enabled = GLAD_GL_EXT_disjoint_timer_query;
+    if (g_state.timers.enabled) {
+        glGenQueries(timer_frames * num_timer_passes, &g_state.timers.queries[0][0]);
+        // reading the flag clears it
+        GLint disjoint;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    }
+}
+
+void reset_timers() {
+    for (int i = 0; i < num_timer_passes; i++) {
+        g_state.timers.gpu_ms[i] = 0.0;
+        g_state.timers.cpu_ms[i] = 0.0;
+    }
+    g_state.timers.timed_frames = 0;
+    g_state.timers.dropped_frames = 0;
+    g_state.timers.cpu_frames = 0;
+    // results of earlier frames are not wanted any more
+    memset(g_state.timers.pending, 0, sizeof(g_state.timers.pending));
+}
+
+// reads back the slot's queries if they are done, returns whether the slot
+// is free again
+bool collect_timers(int slot) {
+    if (!g_state.timers.pending[slot]) return true;
+
+    GLuint available = 0;
+    glGetQueryObjectuiv(g_state.timers.queries[slot][num_timer_passes - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return false;
+
+    // a disjoint operation (clock change, power event) invalidates every
+    // query that was in flight, drop the frame
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        g_state.timers.dropped_frames++;
+    } else {
+        for (int pass = 0; pass < num_timer_passes; pass++) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64vEXT(g_state.timers.queries[slot][pass], GL_QUERY_RESULT, &ns);
+            g_state.timers.gpu_ms[pass] += ns / 1e6;
+        }
+        g_state.timers.timed_frames++;
+    }
+    g_state.timers.pending[slot] = false;
+    return true;
+}
+
+void begin_timed_frame() {
+    int slot = g_state.timers.slot;
+    g_state.timers.active = g_state.timers.enabled && collect_timers(slot);
+    if (g_state.timers.enabled && !g_state.timers.active) g_state.timers.dropped_frames++;
+}
+
+void end_timed_frame() {
+    if (g_state.timers.active) g_state.timers.pending[g_state.timers.slot] = true;
+    g_state.timers.slot = (g_state.timers.slot + 1) % timer_frames;
+    g_state.timers.cpu_frames++;
+}
+
+void begin_pass(timer_pass pass) {
+    if (g_state.timers.active) glBeginQuery(GL_TIME_ELAPSED_EXT, g_state.timers.queries[g_state.timers.slot][pass]);
+    g_state.timers.cpu_start = std::chrono::steady_clock::now();
+}
+
+void end_pass(timer_pass pass) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - g_state.timers.cpu_start;
+    g_state.timers.cpu_ms[pass] += elapsed.count();
+    if (g_state.timers.active) glEndQuery(GL_TIME_ELAPSED_EXT);
+}
+
+// BACKEND_THREADS: one buffer holding upload_slots copies of the positions.
+// with EXT_buffer_storage it is mapped once, persistent and coherent,
+// otherwise each frame maps its slot unsynchronized. either way the slot
+// is fenced, so the cpu never writes what the gpu is still drawing
+bool setup_upload_ring() {
+    GLsizeiptr slot_size = (GLsizeiptr)g_state.num_particles * 2 * sizeof(float);
+
+    glGenBuffers(1, &g_state.upload.buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, g_state.upload.buffer);
+    if (GLAD_GL_EXT_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+        glBufferStorageEXT(GL_ARRAY_BUFFER, slot_size * upload_slots, NULL, flags);
+        g_state.upload.mapped = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, slot_size * upload_slots, flags);
+        if (!g_state.upload.mapped) {
+            std::cerr << "failed to map the upload ring persistently" << std::endl;
+            return false;
+        }
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, slot_size * upload_slots, NULL, GL_STREAM_DRAW);
+        g_state.upload.mapped = nullptr;
+    }
+
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        std::cerr << "out of memory allocating the upload ring" << std::endl;
+        return false;
+    }
+
+    // slots are drawn with a first vertex offset, one VAO covers all of them
+    glGenVertexArrays(1, &g_state.upload.render_vao);
+    glBindVertexArray(g_state.upload.render_vao);
+    glVertexAttribPointer(g_locs.render.position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(g_locs.render.position);
+    glBindVertexArray(0);
+
+    for (int i = 0; i < upload_slots; i++) g_state.upload.fences[i] = 0;
+    g_state.upload.slot = 0;
+    g_state.upload.stalls = 0;
+    g_state.upload.map_failures = 0;
+    g_state.upload.map_failed = false;
+    return true;
+}
+
+// --snapshot: every n frames the drawn positions are copied on the gpu
+// into one of snapshot_slots buffers and fenced. a later frame maps the
+// buffer once the fence has signaled, so neither side waits, and hands the
+// bytes to the writer thread
+bool setup_snapshots(const particle_options& opts) {
+    g_state.snapshots.frame = 0;
+    g_state.snapshots.next = 0;
+    g_state.snapshots.dropped = 0;
+    g_state.snapshots.every = opts.snapshot_path ? opts.snapshot_every : 0;
+    if (!opts.snapshot_path) return true;
+
+    g_state.snapshots.writer.reset(new snapshot_writer());
+    if (!g_state.snapshots.writer->open(opts.snapshot_path, g_state.format, g_state.num_particles,
+                                        window_width, window_height)) {
+        return false;
+    }
+
+    GLsizeiptr pos_size = (GLsizeiptr)g_state.num_particles * position_size(g_state.format);
+    glGenBuffers(snapshot_slots, g_state.snapshots.buffers);
+    for (int i = 0; i < snapshot_slots; i++) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_state.snapshots.buffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, snapshot_prefix + pos_size, NULL, GL_STREAM_READ);
+        g_state.snapshots.fences[i] = 0;
+    }
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        std::cerr << "out of memory allocating the snapshot buffers" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// --restore: maps the checkpoint and uploads both sections straight out of
+// the mapping, the driver's copy is the only one. the cpu backends also
+// take their own copy of the state from it
+bool restore_checkpoint(const char* path) {
+    checkpoint_mapping mapping;
+    if (!map_checkpoint(path, &mapping)) return false;
+
+    const checkpoint_header& header = mapping.header;
+    if (header.count != (uint32_t)g_state.num_particles || header.position_format != (uint32_t)g_state.format) {
+        std::cerr << path << " holds " << header.count << " particles in format "
+                  << (header.position_format <= FORMAT_FIXED16 ? position_format_name((position_format)header.position_format) : "?")
+                  << ", run with the same --particles and --format" << std::endl;
+        unmap_checkpoint(&mapping);
+        return false;
+    }
+    // the uploads and the cpu copy below read this many bytes
+    if (header.positions_size != (uint64_t)header.count * position_size(g_state.format)) {
+        std::cerr << path << " is corrupt, its positions section does not match its particle count" << std::endl;
+        unmap_checkpoint(&mapping);
+        return false;
+    }
+
+    // procedural velocities come from the seed, which has to be the one
+    // the checkpointed velocities were generated from
+    if (g_state.procedural_velocity && header.rng_seed != g_state.init.seed) {
+        std::cerr << path << " was generated with --seed " << header.rng_seed
+                  << ", --velocity procedural needs the same" << std::endl;
+        unmap_checkpoint(&mapping);
+        return false;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.pos[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)header.positions_size, mapping.positions);
+    if (!g_state.procedural_velocity) {
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)header.velocities_size, mapping.velocities);
+    }
+    if (g_state.backend == BACKEND_CPU || g_state.backend == BACKEND_THREADS) {
+        const float* positions = (const float*)mapping.positions;
+        g_state.cpu.positions.assign(positions, positions + (size_t)header.count * 2);
+        g_state.cpu.velocities.assign(mapping.velocities, mapping.velocities + (size_t)header.count * 2);
+    }
+
+    g_state.clock.time = header.sim_time;
+    g_state.clock.accumulator = header.accumulator;
+    g_state.clock.steps = header.steps;
+    unmap_checkpoint(&mapping);
+    return true;
+}
+
+// INIT_GPU: one transform feedback pass writes the first position buffer
+// and the velocities, nothing crosses the bus. the program is only needed
+// once
+bool init_particles_gpu() {
+    GLuint prog = create_program(init_program());
+    if (!prog) return false;
+
+    initial_state_params params = init_params();
+    glUseProgram(prog);
+    glUniform4ui(glGetUniformLocation(prog, "keys"), params.keys[0], params.keys[1], params.keys[2], params.keys[3]);
+    glUniform2f(glGetUniformLocation(prog, "position_scale"), params.position_scale_x, params.position_scale_y);
+    glUniform1f(glGetUniformLocation(prog, "velocity_scale"), params.velocity_scale);
+
+    // no attributes, the default vertex array will do
+    glBindVertexArray(0);
+    glEnable(GL_RASTERIZER_DISCARD);
+    GLuint tf;
+    glGenTransformFeedbacks(1, &tf);
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tf);
+    GLsizeiptr stride = 2 * sizeof(float);
+    for (int first = 0; first < g_state.num_particles; first += g_state.chunk_size) {
+        int count = g_state.num_particles - first < g_state.chunk_size ? g_state.num_particles - first : g_state.chunk_size;
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, g_state.buffers.pos[0], (GLintptr)first * stride, (GLsizeiptr)count * stride);
+        // procedural velocities are never stored
+        if (!g_state.procedural_velocity) {
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 1, g_state.buffers.vel, (GLintptr)first * stride, (GLsizeiptr)count * stride);
+        }
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, first, count);
+        glEndTransformFeedback();
+    }
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    glDeleteTransformFeedbacks(1, &tf);
+    glDisable(GL_RASTERIZER_DISCARD);
+    glDeleteProgram(prog);
+    return true;
+}
+
+// --validate with INIT_GPU: reads the state back and compares it bit for bit
+// with initial_state_generate, returns the particles that differ
+int check_initial_state() {
+    size_t floats = (size_t)g_state.num_particles * 2;
+    std::vector<float> cpu_positions(floats);
+    std::vector<float> cpu_velocities(floats);
+    init_particles(cpu_positions.data(), cpu_velocities.data(), g_state.num_particles);
+
+    GLsizeiptr size = (GLsizeiptr)(floats * sizeof(float));
+    glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[0]);
+    glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+    const float* positions = (const float*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT);
+    // procedural velocities are not in a buffer, only the positions can differ
+    const float* velocities = g_state.procedural_velocity
+                            ? cpu_velocities.data()
+                            : (const float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_READ_BIT);
+    int mismatches = g_state.num_particles;
+    if (positions && velocities) {
+        mismatches = 0;
+        for (int i = 0; i < g_state.num_particles; i++) {
+            if (memcmp(positions + 2 * i, &cpu_positions[2 * i], 2 * sizeof(float)) != 0 ||
+                memcmp(velocities + 2 * i, &cpu_velocities[2 * i], 2 * sizeof(float)) != 0) {
+                mismatches++;
+            }
+        }
+    }
+    if (positions) glUnmapBuffer(GL_COPY_READ_BUFFER);
+    if (velocities && !g_state.procedural_velocity) glUnmapBuffer(GL_ARRAY_BUFFER);
+    return mismatches;
+}
+
+// --record: allocates the streams that are not buffers.pos or buffers.vel
+// and sets the transform feedback outputs to the updated streams
+bool setup_records() {
+    const record_layout& layout = g_state.records.layout;
+    for (int s = 0; s < layout.num_streams; s++) {
+        const record_stream& stream = layout.streams[s];
+        GLuint* buffers = g_state.records.buffers[s];
+        if (s == layout.stream_of[RECORD_POSITION]) {
+            for (int i = 0; i < g_state.ring.slots; i++) buffers[i] = g_state.buffers.pos[i];
+        } else if (s == layout.stream_of[RECORD_VELOCITY]) {
+            buffers[0] = g_state.buffers.vel;
+        } else {
+            int count = stream.updated ? g_state.ring.slots : 1;
+            glGenBuffers(count, buffers);
+            for (int i = 0; i < count; i++) {
+                glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+                glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)g_state.num_particles * stream.stride, NULL,
+                             stream.updated ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+            }
+        }
+    }
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        std::cerr << "out of memory allocating " << g_state.num_particles << " particle records" << std::endl;
+        return false;
+    }
+
+    // capture order is stream order, see record_layout_build
+    g_state.tfs.num_outputs = 0;
+    for (int s = 0; s < layout.num_streams; s++) {
+        if (!layout.streams[s].updated) continue;
+        g_state.tfs.outputs[g_state.tfs.num_outputs] = g_state.records.buffers[s];
+        g_state.tfs.strides[g_state.tfs.num_outputs] = layout.streams[s].stride;
+        g_state.tfs.num_outputs++;
+    }
+    return true;
+}
+
+// --record: the position and velocity of the plain pipeline, a color from
+// the direction of travel and age 0, packed into slot 0 of every stream
+// and copied to the rest of the ring, except for the position stream,
+// which setup_graphics copies with the plain buffers
+void init_records() {
+    const record_layout& layout = g_state.records.layout;
+    size_t n = (size_t)g_state.num_particles;
+    std::vector<float> positions(n * 2);
+    std::vector<float> velocities(n * 2);
+    std::vector<float> colors(n * 4);
+    std::vector<float> ages(n, 0.0f);
+    init_particles(positions.data(), velocities.data(), g_state.num_particles);
+    for (size_t i = 0; i < n; i++) {
+        colors[4 * i + 0] = 0.5f + velocities[2 * i + 0] / (2.0f * init_max_speed);
+        colors[4 * i + 1] = 0.5f + velocities[2 * i + 1] / (2.0f * init_max_speed);
+        colors[4 * i + 2] = 0.75f;
+        colors[4 * i + 3] = 1.0f;
+    }
+    const float* fields[num_record_fields] = { positions.data(), velocities.data(), colors.data(), ages.data() };
+
+    std::vector<char> data;
+    for (int s = 0; s < layout.num_streams; s++) {
+        GLsizeiptr size = (GLsizeiptr)n * layout.streams[s].stride;
+        data.resize((size_t)size);
+        for (int f = 0; f < num_record_fields; f++) {
+            if (layout.stream_of[f] == s) record_scatter(layout, f, fields[f], g_state.num_particles, data.data());
+        }
+        const GLuint* buffers = g_state.records.buffers[s];
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, data.data());
+        if (!layout.streams[s].updated || s == layout.stream_of[RECORD_POSITION]) continue;
+        for (int i = 1; i < g_state.ring.slots; i++) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffers[0]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[i]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+        }
+    }
+}
+
+// --record: points every attribute of prog at its field in the given ring
+// slot, for the bound vertex array
+void bind_record_attributes(GLuint prog, int slot) {
+    const record_layout& layout = g_state.records.layout;
+    for (int f = 0; f < num_record_fields; f++) {
+        GLint location = glGetAttribLocation(prog, record_fields[f].name);
+        if (location < 0) continue;
+        int s = layout.stream_of[f];
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.records.buffers[s][layout.streams[s].updated ? slot : 0]);
+        glVertexAttribPointer(location, record_fields[f].components, GL_FLOAT, GL_FALSE, layout.streams[s].stride,
+                              (const void*)(intptr_t)layout.offset_of[f]);
+        glEnableVertexAttribArray(location);
+    }
+}
+
+// --record: one field of every particle in the given ring slot, read back
+std::vector<float> read_record_field(int field, int slot) {
+    const record_layout& layout = g_state.records.layout;
+    int s = layout.stream_of[field];
+    std::vector<float> values((size_t)g_state.num_particles * record_fields[field].components);
+    glBindBuffer(GL_COPY_READ_BUFFER, g_state.records.buffers[s][layout.streams[s].updated ? slot : 0]);
+    const void* stream = glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)g_state.num_particles * layout.streams[s].stride,
+                                          GL_MAP_READ_BIT);
+    if (stream) {
+        record_gather(layout, field, stream, g_state.num_particles, values.data());
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    } else {
+        values.clear();
+    }
+    return values;
+}
+
+// the point size limit and the largest variable size, bind_render_program
+// sets the size uniforms. vertex pulling also gets its draw size, bound
+// like the splat pass, and a vertex array without attributes
+bool setup_sizes(const particle_options& opts) {
+    GLfloat range[2];
+    glGetFloatv(GL_ALIASED_POINT_SIZE_RANGE, range);
+    g_state.sizes.point_size_limit = range[1];
+    g_state.sizes.max_size = opts.max_size;
+    if (opts.render != RENDER_PULLED) return true;
+
+    GLint vertex_blocks, max_block_size, alignment;
+    glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertex_blocks);
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (vertex_blocks < 1) {
+        std::cerr << "--render pulled needs storage buffers in vertex shaders" << std::endl;
+        return false;
+    }
+    int align_particles = alignment > (int)(2 * sizeof(float)) ? alignment / (int)(2 * sizeof(float)) : 1;
+    long long max_pull = max_block_size / (2 * sizeof(float)) - align_particles;
+    if (g_state.chunk_size < max_pull) max_pull = g_state.chunk_size;
+    if (INT_MAX / 6 < max_pull) max_pull = INT_MAX / 6;
+    g_state.sizes.max_pull = (int)max_pull;
+    g_state.sizes.align_particles = align_particles;
+    glGenVertexArrays(1, &g_state.sizes.vao);
+    return true;
+}
+
+// points the render position attribute at offset into the bound array
+// buffer, in the position format
+void render_position_pointer(GLintptr offset) {
+    switch (g_state.format) {
+        case FORMAT_FIXED32: glVertexAttribPointer(g_locs.render.position, 2, GL_UNSIGNED_INT, GL_TRUE, 0, (const void*)offset); break;
+        case FORMAT_FIXED16: glVertexAttribPointer(g_locs.render.position, 2, GL_UNSIGNED_SHORT, GL_TRUE, 0, (const void*)offset); break;
+        default: glVertexAttribPointer(g_locs.render.position, 2, GL_FLOAT, GL_FALSE, 0, (const void*)offset); break;
+    }
+}
+
+// --render splat and splat-cpu: the image both resolve into and the
+// framebuffer it is blitted from, then the count buffer and programs of
+// the compute splat or the cpu side buffers
+bool setup_splat(render_mode mode) {
+    if (mode != RENDER_SPLAT && mode != RENDER_SPLAT_CPU) return true;
+    size_t cells = (size_t)window_width * window_height;
+
+    glGenTextures(1, &g_state.splat.image);
+    glBindTexture(GL_TEXTURE_2D, g_state.splat.image);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, window_width, window_height);
+
+    GLint read_framebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+    glGenFramebuffers(1, &g_state.splat.framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_state.splat.framebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_state.splat.image, 0);
+    bool complete = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+    if (!complete) {
+        std::cerr << "the splat image cannot be blitted from" << std::endl;
+        return false;
+    }
+
+    if (mode == RENDER_SPLAT_CPU) {
+        g_state.splat.cpu_counts.assign(cells, 0);
+        g_state.splat.pixels.resize(cells);
+        return true;
+    }
+
+    std::vector<program_source> sources = splat_programs();
+    g_state.splat.splat_prog = create_program(sources[0]);
+    g_state.splat.resolve_prog = create_program(sources[1]);
+    if (!g_state.splat.splat_prog || !g_state.splat.resolve_prog) return false;
+    g_locs.splat.skip = glGetUniformLocation(g_state.splat.splat_prog, "skip");
+    g_locs.splat.count = glGetUniformLocation(g_state.splat.splat_prog, "count");
+    glProgramUniform2i(g_state.splat.splat_prog, glGetUniformLocation(g_state.splat.splat_prog, "canvas_size"),
+                       window_width, window_height);
+    glProgramUniform2i(g_state.splat.resolve_prog, glGetUniformLocation(g_state.splat.resolve_prog, "canvas_size"),
+                       window_width, window_height);
+
+    // the counts start at zero, afterwards every resolve clears them
+    std::vector<uint32_t> zeros(cells, 0);
+    glGenBuffers(1, &g_state.splat.counts);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_state.splat.counts);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(cells * sizeof(uint32_t)), zeros.data(), GL_DYNAMIC_COPY);
+
+    // as in setup_compute, a dispatch is limited by the group count and the
+    // storage block size, which has to fit the skipped particles too
+    GLint max_groups, max_block_size, alignment;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    int align_particles = alignment > (int)(2 * sizeof(float)) ? alignment / (int)(2 * sizeof(float)) : 1;
+    long long max_dispatch = (long long)max_groups * splat_local_size;
+    long long block_particles = max_block_size / (2 * sizeof(float)) - align_particles;
+    if (block_particles < max_dispatch) max_dispatch = block_particles;
+    if (max_dispatch <= 0 || (long long)(cells * sizeof(uint32_t)) > max_block_size) {
+        std::cerr << "the storage block size is too small for --render splat" << std::endl;
+        return false;
+    }
+    g_state.splat.max_dispatch = (int)max_dispatch;
+    g_state.splat.align_particles = align_particles;
+    return true;
+}
+
+bool setup_graphics(const particle_options& opts) {
+    // before the first gl call, so the shadow sees every change
+    if (opts.state_cache) state_cache_install();
+    g_state.num_particles = opts.num_particles;
+    g_state.chunk_size = opts.chunk_size;
+    g_state.backend = opts.backend;
+    g_state.format = opts.format;
+    g_state.procedural_velocity = opts.procedural_velocity;
+    record_layout_build(&g_state.records.layout, opts.record);
+    bool records = opts.record != RECORD_NONE;
+    g_state.cpu.isa = opts.isa;
+    g_state.clock.step = opts.step;
+    g_state.clock.max_substeps = opts.max_substeps;
+    g_state.clock.accumulator = 0.0;
+    g_state.clock.time = 0.0;
+    g_state.clock.steps = 0;
+    g_state.clock.most_substeps = 0;
+    g_state.clock.dropped = 0.0;
+    g_state.emitter.enabled = opts.lifetime > 0.0;
+    g_state.emitter.lifetime = (float)opts.lifetime;
+    g_state.emitter.rate = opts.emit_rate > 0.0 ? opts.emit_rate : opts.num_particles / opts.lifetime;
+    g_state.interaction.enabled = opts.interact_radius > 0.0f;
+    g_state.reorder.every = opts.reorder_every;
+    g_state.reorder.frames = 0;
+    g_state.reorder.passes = 0;
+    g_state.reorder.seconds = 0.0;
+    g_state.init.seed = opts.seed;
+    g_state.init.seconds = 0.0;
+    g_state.render = opts.render;
+    g_state.programs.cache_dir = opts.program_cache_dir;
+    g_state.programs.count = 0;
+    g_state.programs.cache_hits = 0;
+    g_state.programs.rejected = 0;
+    g_state.programs.seconds = 0.0;
+    g_state.programs.parallel = GLAD_GL_KHR_parallel_shader_compile && opts.compile_threads != 0;
+    g_state.programs.ready = 0;
+    if (GLAD_GL_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(opts.compile_threads < 0 ? 0xffffffffu : (GLuint)opts.compile_threads);
+    }
+    GLint binary_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binary_formats);
+    if (g_state.programs.cache_dir && binary_formats == 0) {
+        // mesa has none with its own shader cache disabled, say
+        std::cerr << "the driver cannot save program binaries, ignoring --program-cache" << std::endl;
+        g_state.programs.cache_dir = nullptr;
+    }
+    g_state.init.mismatches = -1;
+    g_state.reload.watching = false;
+    g_state.reload.reloads = 0;
+    g_state.reload.failures = 0;
+    g_state.reload.has_pending = false;
+    if (opts.shader_dir && !setup_shader_dir(opts.shader_dir)) return false;
+
+    // compute needs an ES 3.1 context, the demos ask for 3.0 but most
+    // drivers hand out the newest compatible version
+    if (g_state.backend == BACKEND_AUTO) {
+        bool compute = GLAD_GL_ES_VERSION_3_1 && (g_state.format == FORMAT_FLOAT || g_state.emitter.enabled) &&
+                       opts.systems == 1 && !records;
+        g_state.backend = compute ? BACKEND_COMPUTE : (g_state.interaction.enabled ? BACKEND_THREADS : BACKEND_TF);
+    }
+    if (g_state.format != FORMAT_FLOAT && g_state.backend != BACKEND_TF) {
+        std::cerr << "fixed point positions need the tf backend" << std::endl;
+        return false;
+    }
+    if (g_state.emitter.enabled && (g_state.backend != BACKEND_COMPUTE || g_state.format != FORMAT_FLOAT ||
+                                    g_state.reorder.every > 0)) {
+        std::cerr << "--lifetime needs the compute backend, float positions and no --reorder" << std::endl;
+        return false;
+    }
+    if (g_state.interaction.enabled && (g_state.backend == BACKEND_TF || g_state.format != FORMAT_FLOAT ||
+                                        g_state.emitter.enabled)) {
+        std::cerr << "--interact needs the compute, cpu or threads backend, float positions and no --lifetime" << std::endl;
+        return false;
+    }
+    if (opts.systems > 1 && (g_state.backend != BACKEND_TF || g_state.format != FORMAT_FLOAT ||
+                             g_state.reorder.every > 0 || opts.systems > g_state.num_particles)) {
+        std::cerr << "--systems needs the tf backend, float positions, no --reorder and a particle per system" << std::endl;
+        return false;
+    }
+    if (g_state.procedural_velocity && ((g_state.backend != BACKEND_TF && g_state.backend != BACKEND_COMPUTE) ||
+                                        opts.systems > 1 || g_state.interaction.enabled ||
+                                        g_state.emitter.enabled || g_state.reorder.every > 0)) {
+        // the velocity has to stay the one of the particle's index
+        std::cerr << "--velocity procedural needs the tf or compute backend, one system"
+                  << " and no --interact, --lifetime or --reorder" << std::endl;
+        return false;
+    }
+    if (records && (g_state.backend != BACKEND_TF || g_state.format != FORMAT_FLOAT || opts.systems > 1 ||
+                    g_state.reorder.every > 0 || g_state.procedural_velocity ||
+                    opts.snapshot_path || opts.checkpoint_path || opts.restore_path)) {
+        // the rest of the pipeline expects plain position buffers
+        std::cerr << "--record needs the tf backend, float positions, one system, buffered velocities"
+                  << " and no --reorder, --snapshot, --checkpoint or --restore" << std::endl;
+        return false;
+    }
+    bool gpu_init = (g_state.backend == BACKEND_TF || g_state.backend == BACKEND_COMPUTE) &&
+                    g_state.format == FORMAT_FLOAT && opts.systems == 1 && !records;
+    if (opts.init == INIT_GPU && !gpu_init) {
+        std::cerr << "--init gpu needs the tf or compute backend, float positions, one system and no --record" << std::endl;
+        return false;
+    }
+    gpu_init = gpu_init && opts.init != INIT_CPU;
+    if (opts.render == RENDER_SPLAT && (!GLAD_GL_ES_VERSION_3_1 || g_state.format != FORMAT_FLOAT ||
+                                        g_state.emitter.enabled || records)) {
+        // the splat pass reads the positions as a storage buffer of vec2
+        std::cerr << "--render splat needs an OpenGL ES 3.1 context, float positions"
+                  << " and no --lifetime or --record" << std::endl;
+        return false;
+    }
+    bool sized = opts.render == RENDER_SIZED_POINTS || opts.render == RENDER_INSTANCED || opts.render == RENDER_PULLED;
+    if (sized && (g_state.emitter.enabled || records)) {
+        // sizes follow the particle's index, which the emitter compacts
+        std::cerr << "--render " << render_mode_name(opts.render) << " cannot be combined with --lifetime or --record" << std::endl;
+        return false;
+    }
+    if (opts.render == RENDER_PULLED && (!GLAD_GL_ES_VERSION_3_1 || g_state.format != FORMAT_FLOAT)) {
+        std::cerr << "--render pulled needs an OpenGL ES 3.1 context and float positions" << std::endl;
+        return false;
+    }
+    if (opts.render == RENDER_SPLAT_CPU && g_state.backend != BACKEND_CPU && g_state.backend != BACKEND_THREADS) {
+        std::cerr << "--render splat-cpu needs the cpu or threads backend" << std::endl;
+        return false;
+    }
+    if (g_state.emitter.enabled && (opts.checkpoint_path || opts.restore_path)) {
+        std::cerr << "--lifetime does not support --checkpoint or --restore" << std::endl;
+        return false;
+    }
+    if (g_state.backend == BACKEND_COMPUTE && !GLAD_GL_ES_VERSION_3_1) {
+        std::cerr << "the compute backend needs an OpenGL ES 3.1 context" << std::endl;
+        return false;
+    }
+    // every return from here on, failed or not, drops what was not taken
+    struct program_release {
+        ~program_release() { release_programs(); }
+    } submitted_release;
+    if (g_state.programs.parallel) submit_programs(opts, gpu_init);
+    if (g_state.backend == BACKEND_COMPUTE) {
+        if (!setup_compute(opts.workgroup_size)) return false;
+        if (g_state.emitter.enabled && !setup_emitter(g_state.num_particles)) return false;
+    }
+    if (g_state.interaction.enabled && !setup_interaction(opts.interact_radius, opts.interact_strength)) return false;
+
+    // create shaders
+    g_state.update_prog = create_program(update_program(opts));
+    g_state.render_prog = create_program(render_program(opts));
+    if (!g_state.update_prog || !g_state.render_prog) return false;
+    if (!setup_sizes(opts)) return false;
+    if (!setup_systems(opts.systems)) return false;
+
+    // get locations
+    bind_update_program();
+    bind_render_program();
+
+    // allocate every buffer once at its final size
+    // with --record the position buffers hold the position stream, whole
+    // records if interleaved
+    GLsizeiptr buffer_size = (GLsizeiptr)g_state.num_particles * 2 * sizeof(float);
+    GLsizeiptr pos_size = (GLsizeiptr)g_state.num_particles * position_size(g_state.format);
+    if (records) {
+        const record_layout& layout = g_state.records.layout;
+        pos_size = (GLsizeiptr)g_state.num_particles * layout.streams[layout.stream_of[RECORD_POSITION]].stride;
+    }
+
+    // compute updates in place and only needs the first position buffer,
+    // the emitter compacts from one buffer into the other
+    g_state.ring.slots = g_state.backend == BACKEND_COMPUTE ? (g_state.emitter.enabled ? 2 : 1) : opts.ring_slots;
+    g_state.ring.read = 0;
+    g_state.ring.stalls = 0;
+    for (int i = 0; i < g_state.ring.slots; i++) g_state.ring.fences[i] = 0;
+
+    glGenBuffers(g_state.ring.slots, g_state.buffers.pos);
+    glGenBuffers(1, &g_state.buffers.vel);
+
+    for (int i = 0; i < g_state.ring.slots; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.pos[i]);
+        glBufferData(GL_ARRAY_BUFFER, pos_size, NULL, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+    bool no_velocities = g_state.emitter.enabled || g_state.procedural_velocity ||
+                         g_state.records.layout.mode == RECORD_INTERLEAVED;
+    glBufferData(GL_ARRAY_BUFFER, no_velocities ? 0 : buffer_size, NULL, GL_STATIC_DRAW);
+
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        std::cerr << "out of memory allocating " << g_state.num_particles << " particles" << std::endl;
+        return false;
+    }
+    g_state.tfs.num_outputs = 1;
+    g_state.tfs.outputs[0] = g_state.buffers.pos;
+    g_state.tfs.strides[0] = position_size(g_state.format);
+    if (records && !setup_records()) return false;
+
+    std::chrono::steady_clock::time_point init_start = std::chrono::steady_clock::now();
+    if (g_state.emitter.enabled) {
+        // nothing to initialize, particles are spawned on the gpu
+        g_state.init.source = "emitter";
+    } else if (opts.restore_path) {
+        if (!restore_checkpoint(opts.restore_path)) return false;
+        g_state.init.source = "checkpoint";
+    } else if (records) {
+        init_records();
+        g_state.init.source = "cpu";
+    } else if (gpu_init) {
+        if (!init_particles_gpu()) return false;
+        g_state.init.source = "gpu";
+    } else if (g_state.backend == BACKEND_CPU || g_state.backend == BACKEND_THREADS) {
+        // the cpu backends keep their own copy of the state, upload from there
+        g_state.cpu.positions.resize((size_t)g_state.num_particles * 2);
+        g_state.cpu.velocities.resize((size_t)g_state.num_particles * 2);
+        init_particles(g_state.cpu.positions.data(), g_state.cpu.velocities.data(), g_state.num_particles);
+
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.pos[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, buffer_size, g_state.cpu.positions.data());
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, buffer_size, g_state.cpu.velocities.data());
+        g_state.init.source = "cpu";
+    } else {
+        // generate the initial state straight into the mapped buffers, no
+        // intermediate copies
+        const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_state.buffers.pos[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+        void* positions = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, pos_size, map_flags);
+        std::vector<float> unused_velocities(g_state.procedural_velocity ? (size_t)g_state.num_particles * 2 : 0);
+        float* velocities = g_state.procedural_velocity
+                          ? unused_velocities.data()
+                          : (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, map_flags);
+        if (!positions || !velocities) {
+            std::cerr << "failed to map particle buffers" << std::endl;
+            return false;
+        }
+
+        if (g_state.format == FORMAT_FLOAT) {
+            init_particles((float*)positions, velocities, g_state.num_particles);
+            place_in_systems((float*)positions);
+        } else {
+            // same initial state as the float format, encoded afterwards
+            std::vector<float> float_positions((size_t)g_state.num_particles * 2);
+            init_particles(float_positions.data(), velocities, g_state.num_particles);
+            encode_positions(float_positions.data(), (uint32_t*)positions, g_state.num_particles, g_state.format);
+        }
+
+        bool pos_ok = glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        bool vel_ok = g_state.procedural_velocity || glUnmapBuffer(GL_ARRAY_BUFFER);
+        if (!pos_ok || !vel_ok) {
+            std::cerr << "particle buffer contents were lost during upload" << std::endl;
+            return false;
+        }
+        g_state.init.source = "cpu";
+    }
+    glFinish();
+    std::chrono::duration<double> init_elapsed = std::chrono::steady_clock::now() - init_start;
+    g_state.init.seconds = init_elapsed.count();
+    if (opts.validate && strcmp(g_state.init.source, "gpu") == 0) {
+        g_state.init.mismatches = check_initial_state();
+    }
+
+    // the other position buffers are gpu side copies of the first
+    for (int i = 1; i < g_state.ring.slots && !g_state.emitter.enabled; i++) {
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[0]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_state.buffers.pos[i]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pos_size);
+    }
+
+    if (g_state.backend == BACKEND_THREADS || g_state.reorder.every > 0 || opts.render == RENDER_SPLAT_CPU) {
+        g_state.cpu.pool.reset(new thread_pool(opts.threads));
+    }
+    if (!setup_splat(opts.render)) return false;
+    if (g_state.backend == BACKEND_THREADS) {
+        if (!setup_upload_ring()) return false;
+    }
+    release_programs();
+
+    setup_timers();
+    reset_timers();
+    if (!setup_snapshots(opts)) return false;
+
+    // create VAOs
+    glGenVertexArrays(g_state.ring.slots, g_state.vaos.update);
+    glGenVertexArrays(g_state.ring.slots, g_state.vaos.render);
+
+    // set up update VAOs
+    for (int i = 0; i < g_state.ring.slots; i++) {
+        glBindVertexArray(g_state.vaos.update[i]);
+        if (records) {
+            bind_record_attributes(g_state.update_prog, i);
+            continue;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.pos[i]);
+        switch (g_state.format) {
+            case FORMAT_FIXED32: glVertexAttribIPointer(g_locs.update.old_position, 2, GL_UNSIGNED_INT, 0, 0); break;
+            case FORMAT_FIXED16: glVertexAttribIPointer(g_locs.update.old_position, 1, GL_UNSIGNED_INT, 0, 0); break;
+            default: glVertexAttribPointer(g_locs.update.old_position, 2, GL_FLOAT, GL_FALSE, 0, 0); break;
+        }
+        glEnableVertexAttribArray(g_locs.update.old_position);
+
+        if (!g_state.procedural_velocity) {
+            glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+            glVertexAttribPointer(g_locs.update.velocity, 2, GL_FLOAT, GL_FALSE, 0, 0);
+            glEnableVertexAttribArray(g_locs.update.velocity);
+        }
+    }
+
+    // set up render VAOs, fixed point positions are fetched normalized to
+    // [0, 1] and scaled to the canvas by the mvp
+    for (int i = 0; i < g_state.ring.slots; i++) {
+        glBindVertexArray(g_state.vaos.render[i]);
+        if (records) {
+            bind_record_attributes(g_state.render_prog, i);
+            continue;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.pos[i]);
+        render_position_pointer(0);
+        glEnableVertexAttribArray(g_locs.render.position);
+    }
+    // instanced quads advance the position once per instance
+    for (int i = 0; i < g_state.ring.slots && opts.render == RENDER_INSTANCED; i++) {
+        glBindVertexArray(g_state.vaos.render[i]);
+        glVertexAttribDivisor(g_locs.render.position, 1);
+    }
+    if (g_state.backend == BACKEND_THREADS && opts.render == RENDER_INSTANCED) {
+        glBindVertexArray(g_state.upload.render_vao);
+        glVertexAttribDivisor(g_locs.render.position, 1);
+    }
+
+    // create transform feedbacks, the output range is bound per chunk
+    glGenTransformFeedbacks(g_state.ring.slots, g_state.tfs.tf);
+
+    if (opts.shader_dir) start_shader_reload(opts);
+    return true;
+}
+
+// the slot about to be written was drawn ring.slots - 1 frames ago. waiting
+// for that draw keeps the cpu at most that many frames ahead of the gpu,
+// and with three or more slots the update of the next frame never waits
+// for the current frame's raster
+void wait_ring_slot(int slot) {
+    GLsync fence = g_state.ring.fences[slot];
+    if (!fence) return;
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        g_state.ring.stalls++;
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    }
+    glDeleteSync(fence);
+    g_state.ring.fences[slot] = 0;
+}
+
+// update particle positions using transform feedback, from the read slot
+// of the ring into the next one. the shader loops over the substeps, so a
+// catch-up frame is still one pass over the buffers
+void update_tf(float delta_time, int substeps) {
+    int write = ring_write_slot();
+    wait_ring_slot(write);
+
+    glUseProgram(g_state.update_prog);
+    glBindVertexArray(g_state.vaos.update[g_state.ring.read]);
+
+    glUniform1f(g_locs.update.delta_time, delta_time);
+    glUniform1i(g_locs.update.substeps, substeps);
+    if (g_state.systems.count > 1) {
+        glUniform1i(g_state.systems.per_system_location, g_state.systems.per_system);
+        glUniform1i(g_state.systems.num_systems_location, g_state.systems.count);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 0, g_state.systems.ubo);
+    } else if (g_state.format == FORMAT_FLOAT) {
+        glUniform2f(g_locs.update.canvas_size, window_width, window_height);
+    } else {
+        float units = (float)(1ull << position_bits(g_state.format));
+        glUniform2f(g_locs.update.position_scale, units / window_width, units / window_height);
+    }
+
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    // transform feedback writes to the start of the bound range, so each
+    // chunk binds the matching slice of every output buffer (only the
+    // position buffer without --record)
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, g_state.tfs.tf[write]);
+    for (int first = 0; first < g_state.num_particles; first += g_state.chunk_size) {
+        int count = g_state.num_particles - first < g_state.chunk_size ? g_state.num_particles - first : g_state.chunk_size;
+        for (int k = 0; k < g_state.tfs.num_outputs; k++) {
+            GLsizeiptr stride = g_state.tfs.strides[k];
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, k, g_state.tfs.outputs[k][write],
+                              (GLintptr)first * stride, (GLsizeiptr)count * stride);
+        }
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, first, count);
+        glEndTransformFeedback();
+    }
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+    glDisable(GL_RASTERIZER_DISCARD);
+}
+
+// update particle positions in place with the compute shader, the storage
+// blocks are bound per dispatch so no single range exceeds the driver limits
+void update_compute(float delta_time, int substeps) {
+    glUseProgram(g_state.compute.prog);
+    glUniform1f(g_locs.compute.delta_time, delta_time);
+    glUniform1i(g_locs.compute.substeps, substeps);
+    glUniform2f(g_locs.compute.canvas_size, window_width, window_height);
+
+    int step = g_state.compute.max_dispatch;
+    for (int first = 0; first < g_state.num_particles; first += step) {
+        int count = g_state.num_particles - first < step ? g_state.num_particles - first : step;
+        GLintptr offset = (GLintptr)first * 2 * sizeof(float);
+        GLsizeiptr size = (GLsizeiptr)count * 2 * sizeof(float);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, g_state.buffers.pos[0], offset, size);
+        if (g_state.procedural_velocity) glUniform1ui(g_locs.compute.base, (GLuint)first);
+        else glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, g_state.buffers.vel, offset, size);
+        glUniform1ui(g_locs.compute.count, (GLuint)count);
+        glDispatchCompute((count + g_state.compute.workgroup_size - 1) / g_state.compute.workgroup_size, 1, 1);
+    }
+
+    // the render pass reads the same buffer as vertex attributes
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// runs prog over count invocations, in dispatches of at most max_dispatch
+void dispatch_interaction(GLuint prog, GLint base_location, int count) {
+    int wg = g_state.compute.workgroup_size;
+    int step = g_state.interaction.max_dispatch;
+    glUseProgram(prog);
+    for (int first = 0; first < count; first += step) {
+        int n = count - first < step ? count - first : step;
+        glUniform1ui(base_location, (GLuint)first);
+        glDispatchCompute((n + wg - 1) / wg, 1, 1);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// interaction mode update on the gpu, the grid is rebuilt every substep
+// since the next one moves the particles out of their cells
+void update_interaction(float delta_time, int substeps) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_state.buffers.pos[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_state.buffers.vel);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, g_state.interaction.cell_counts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_state.interaction.cell_start);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, g_state.interaction.particle_cells);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, g_state.interaction.sorted_positions);
+    glProgramUniform1f(g_state.interaction.interact_prog, g_locs.interaction.delta_time, delta_time);
+
+    int num_cells = g_state.interaction.grid.cols * g_state.interaction.grid.rows;
+    for (int k = 0; k < substeps; k++) {
+        dispatch_interaction(g_state.interaction.clear_prog, g_locs.interaction.clear_base, num_cells);
+        dispatch_interaction(g_state.interaction.count_prog, g_locs.interaction.count_base, g_state.num_particles);
+        glUseProgram(g_state.interaction.scan_prog);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        dispatch_interaction(g_state.interaction.scatter_prog, g_locs.interaction.scatter_base, g_state.num_particles);
+        dispatch_interaction(g_state.interaction.interact_prog, g_locs.interaction.interact_base, g_state.num_particles);
+    }
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// interaction mode on the cpu backends: rebuilds the grid from the current
+// positions and updates the velocities, on the pool if there is one
+void interact_cpu(float delta_time) {
+    interaction_grid& grid = g_state.interaction.grid;
+    interaction_grid_build(&grid, g_state.cpu.positions.data(), g_state.num_particles);
+
+    float radius = g_state.interaction.radius;
+    float strength = g_state.interaction.strength;
+    float* velocities = g_state.cpu.velocities.data();
+    if (!g_state.cpu.pool) {
+        interaction_accelerate(g_state.cpu.isa, grid, radius, strength, delta_time, velocities, 0, g_state.num_particles);
+        return;
+    }
+    // tasks take runs of the sorted order, so neighbouring particles share
+    // a task and its cache
+    int num_tasks = (g_state.num_particles + cpu_task_particles - 1) / cpu_task_particles;
+    g_state.cpu.pool->parallel_for(num_tasks, [&](int task) {
+        int first = task * cpu_task_particles;
+        int last = first + cpu_task_particles < g_state.num_particles ? first + cpu_task_particles : g_state.num_particles;
+        interaction_accelerate(g_state.cpu.isa, grid, radius, strength, delta_time, velocities, first, last);
+    });
+}
+
+// emission mode update: compacts the survivors of the read slot into the
+// write slot, appends this frame's spawns and builds the draw command. the
+// cpu only decides how many particles to spawn
+void update_emitter(float delta_time, int substeps) {
+    int read = g_state.ring.read;
+    int write = ring_write_slot();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_state.buffers.pos[read]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_state.emitter.states[read]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, g_state.buffers.pos[write]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_state.emitter.states[write]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, g_state.emitter.counters);
+
+    int wg = g_state.compute.workgroup_size;
+    int step = g_state.emitter.max_dispatch;
+
+    // the live count is only known on the gpu, so cover the whole capacity
+    // and let the shader skip what is past the count
+    glUseProgram(g_state.emitter.update_prog);
+    glUniform1f(g_locs.emitter.delta_time, delta_time);
+    glUniform2f(g_locs.emitter.canvas_size, window_width, window_height);
+    glUniform1i(g_locs.emitter.substeps, substeps);
+    glUniform1f(g_locs.emitter.lifetime, g_state.emitter.lifetime);
+    for (int first = 0; first < g_state.num_particles; first += step) {
+        int count = g_state.num_particles - first < step ? g_state.num_particles - first : step;
+        glUniform1ui(g_locs.emitter.update_base, (GLuint)first);
+        glDispatchCompute((count + wg - 1) / wg, 1, 1);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    g_state.emitter.pending += g_state.emitter.rate * delta_time * substeps;
+    int spawns = (int)g_state.emitter.pending;
+    g_state.emitter.pending -= spawns;
+    if (spawns > g_state.num_particles) spawns = g_state.num_particles;
+    if (spawns > 0) {
+        glUseProgram(g_state.emitter.spawn_prog);
+        glUniform1ui(g_locs.emitter.spawn_count, (GLuint)spawns);
+        glUniform1ui(g_locs.emitter.spawn_serial, (GLuint)g_state.emitter.spawned);
+        glUniform1ui(g_locs.emitter.spawn_capacity, (GLuint)g_state.num_particles);
+        glUniform2f(g_locs.emitter.emitter, window_width * 0.5f, window_height * 0.5f);
+        for (int first = 0; first < spawns; first += step) {
+            int count = spawns - first < step ? spawns - first : step;
+            glUniform1ui(g_locs.emitter.spawn_base, (GLuint)first);
+            glDispatchCompute((count + wg - 1) / wg, 1, 1);
+        }
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        g_state.emitter.spawned += spawns;
+    }
+
+    glUseProgram(g_state.emitter.finish_prog);
+    glUniform1ui(g_locs.emitter.finish_capacity, (GLuint)g_state.num_particles);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// update particle positions on the cpu and upload them into the buffer the
+// transform feedback pass would have written
+void update_cpu(float delta_time, int substeps) {
+    float* positions = g_state.cpu.positions.data();
+    for (int k = 0; k < substeps; k++) {
+        if (g_state.interaction.enabled) interact_cpu(delta_time);
+        cpu_update_positions(g_state.cpu.isa, positions, g_state.cpu.velocities.data(), positions,
+                             g_state.num_particles, delta_time, window_width, window_height);
+    }
+
+    int write = ring_write_slot();
+    wait_ring_slot(write);
+    glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.pos[write]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)g_state.num_particles * 2 * sizeof(float), positions);
+}
+
+// update particle positions on the thread pool, every task runs all
+// substeps on its slice while it is in cache and writes it straight into
+// this frame's slot of the upload ring. 0 substeps republishes the state
+void update_threads(float delta_time, int substeps) {
+    int slot = g_state.upload.slot;
+    GLsizeiptr slot_size = (GLsizeiptr)g_state.num_particles * 2 * sizeof(float);
+
+    // the slot was drawn upload_slots frames ago, normally long finished
+    GLsync fence = g_state.upload.fences[slot];
+    if (fence) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            g_state.upload.stalls++;
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        }
+        glDeleteSync(fence);
+        g_state.upload.fences[slot] = 0;
+    }
+
+    float* dst;
+    if (g_state.upload.mapped) {
+        dst = g_state.upload.mapped + (size_t)slot * g_state.num_particles * 2;
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.upload.buffer);
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        dst = (float*)glMapBufferRange(GL_ARRAY_BUFFER, slot * slot_size, slot_size, flags);
+        // the step still runs, the slot is then uploaded from the cpu copy
+        if (!dst) {
+            g_state.upload.map_failures++;
+            if (!g_state.upload.map_failed) {
+                std::cerr << "mapping the upload ring failed, uploading with glBufferSubData" << std::endl;
+            }
+            g_state.upload.map_failed = true;
+        }
+    }
+
+    float* positions = g_state.cpu.positions.data();
+    const float* velocities = g_state.cpu.velocities.data();
+    int num_tasks = (g_state.num_particles + cpu_task_particles - 1) / cpu_task_particles;
+    int task_substeps = substeps;
+    if (g_state.interaction.enabled) {
+        // a step needs every position of the one before, so the steps run
+        // one after another, each spread over the pool
+        for (int k = 0; k < substeps; k++) {
+            interact_cpu(delta_time);
+            g_state.cpu.pool->parallel_for(num_tasks, [&](int task) {
+                size_t first = (size_t)task * cpu_task_particles;
+                int count = g_state.num_particles - (int)first < cpu_task_particles ? g_state.num_particles - (int)first : cpu_task_particles;
+                cpu_update_positions(g_state.cpu.isa, positions + 2 * first, velocities + 2 * first, positions + 2 * first,
+                                     count, delta_time, window_width, window_height);
+            });
+        }
+        task_substeps = 0;
+    }
+    g_state.cpu.pool->parallel_for(num_tasks, [&](int task) {
+        size_t first = (size_t)task * cpu_task_particles;
+        int count = g_state.num_particles - (int)first < cpu_task_particles ? g_state.num_particles - (int)first : cpu_task_particles;
+        for (int k = 0; k < task_substeps; k++) {
+            cpu_update_positions(g_state.cpu.isa, positions + 2 * first, velocities + 2 * first, positions + 2 * first,
+                                 count, delta_time, window_width, window_height);
+        }
+        if (dst) memcpy(dst + 2 * first, positions + 2 * first, (size_t)count * 2 * sizeof(float));
+    });
+
+    if (!g_state.upload.mapped) {
+        if (dst) glUnmapBuffer(GL_ARRAY_BUFFER);
+        else glBufferSubData(GL_ARRAY_BUFFER, slot * slot_size, slot_size, positions);
+    }
+}
+
+template <typename T>
+void gather(const void* in, void* out, const std::vector<uint32_t>& order, int first, int last) {
+    const T* src = (const T*)in;
+    T* dst = (T*)out;
+    for (int i = first; i < last; i++) dst[i] = src[order[i]];
+}
+
+// sorts the particles by the morton key of their position, velocities move
+// along. the gpu backends read the state back and upload it sorted, which
+// stalls the pipeline; the cpu backends sort their own copy
+void reorder_particles() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int n = g_state.num_particles;
+    GLsizeiptr stride = position_size(g_state.format);
+    GLsizeiptr pos_size = (GLsizeiptr)n * stride;
+    GLsizeiptr vel_size = (GLsizeiptr)n * 2 * sizeof(float);
+    bool on_cpu = g_state.backend == BACKEND_CPU || g_state.backend == BACKEND_THREADS;
+    // the buffer the next update reads
+    GLuint pos_buffer = g_state.buffers.pos[g_state.ring.read];
+
+    std::vector<uint32_t> positions, velocities;
+    if (on_cpu) {
+        positions.resize((size_t)n * 2);
+        velocities.resize((size_t)n * 2);
+        memcpy(positions.data(), g_state.cpu.positions.data(), pos_size);
+        memcpy(velocities.data(), g_state.cpu.velocities.data(), vel_size);
+    } else {
+        positions.resize(pos_size / sizeof(uint32_t));
+        velocities.resize((size_t)n * 2);
+        glBindBuffer(GL_COPY_READ_BUFFER, pos_buffer);
+        const void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, 0, pos_size, GL_MAP_READ_BIT);
+        if (mapped) memcpy(positions.data(), mapped, pos_size);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        if (!mapped) return;
+
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.vel);
+        mapped = glMapBufferRange(GL_COPY_READ_BUFFER, 0, vel_size, GL_MAP_READ_BIT);
+        if (mapped) memcpy(velocities.data(), mapped, vel_size);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        if (!mapped) return;
+    }
+
+    thread_pool* pool = g_state.cpu.pool.get();
+    int num_tasks = (n + cpu_task_particles - 1) / cpu_task_particles;
+    std::vector<uint32_t> keys(n);
+    pool->parallel_for(num_tasks, [&](int task) {
+        int first = task * cpu_task_particles;
+        int last = first + cpu_task_particles < n ? first + cpu_task_particles : n;
+        for (int i = first; i < last; i++) {
+            float x, y;
+            decode_position(positions.data(), i, g_state.format, &x, &y);
+            keys[i] = morton_key(x, y, window_width, window_height);
+        }
+    });
+
+    std::vector<uint32_t> order;
+    radix_sort_order(pool, keys.data(), n, 2 * morton_axis_bits, &order);
+
+    std::vector<uint32_t> sorted_positions(positions.size()), sorted_velocities(velocities.size());
+    pool->parallel_for(num_tasks, [&](int task) {
+        int first = task * cpu_task_particles;
+        int last = first + cpu_task_particles < n ? first + cpu_task_particles : n;
+        if (stride == sizeof(uint32_t)) {
+            gather<uint32_t>(positions.data(), sorted_positions.data(), order, first, last);
+        } else {
+            gather<uint64_t>(positions.data(), sorted_positions.data(), order, first, last);
+        }
+        gather<uint64_t>(velocities.data(), sorted_velocities.data(), order, first, last);
+    });
+
+    if (on_cpu) {
+        memcpy(g_state.cpu.positions.data(), sorted_positions.data(), pos_size);
+        memcpy(g_state.cpu.velocities.data(), sorted_velocities.data(), vel_size);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, pos_buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, pos_size, sorted_positions.data());
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vel_size, sorted_velocities.data());
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    g_state.reorder.passes++;
+    g_state.reorder.seconds += elapsed.count();
+}
+
+// turns the frame time into fixed steps. time is kept in double, so the
+// step count only depends on the summed frame times and the state after n
+// steps is the same whatever the frame rate. returns the steps due now,
+// at most max_substeps, and their length
+int advance_clock(double frame_time, float* delta_time) {
+    if (g_state.clock.step <= 0.0) {
+        *delta_time = (float)frame_time;
+        g_state.clock.time += frame_time;
+        g_state.clock.steps++;
+        if (g_state.clock.most_substeps < 1) g_state.clock.most_substeps = 1;
+        return 1;
+    }
+
+    g_state.clock.accumulator += frame_time;
+    int steps = (int)(g_state.clock.accumulator / g_state.clock.step);
+    g_state.clock.accumulator -= steps * g_state.clock.step;
+    // too far behind: run what fits in one frame and let the rest go
+    // rather than spiral into ever longer catch-up frames
+    if (steps > g_state.clock.max_substeps) {
+        g_state.clock.dropped += (steps - g_state.clock.max_substeps) * g_state.clock.step;
+        steps = g_state.clock.max_substeps;
+    }
+
+    *delta_time = (float)g_state.clock.step;
+    g_state.clock.time += steps * g_state.clock.step;
+    g_state.clock.steps += steps;
+    if (steps > g_state.clock.most_substeps) g_state.clock.most_substeps = steps;
+    return steps;
+}
+
+// hands the slot's copy to the writer if the gpu is done with it, or
+// unconditionally with wait. returns whether the slot is free again
+bool collect_snapshot(int slot, bool wait) {
+    GLsync fence = g_state.snapshots.fences[slot];
+    if (!fence) return true;
+
+    GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                     wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+    glDeleteSync(fence);
+    g_state.snapshots.fences[slot] = 0;
+
+    GLsizeiptr size = snapshot_prefix + (GLsizeiptr)g_state.num_particles * position_size(g_state.format);
+    glBindBuffer(GL_COPY_READ_BUFFER, g_state.snapshots.buffers[slot]);
+    const unsigned char* bytes = (const unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (bytes) {
+        snapshot_frame frame;
+        frame.frame = (uint64_t)g_state.snapshots.frames[slot];
+        frame.sim_time = g_state.snapshots.times[slot];
+        frame.count = (uint32_t)g_state.num_particles;
+        if (g_state.emitter.enabled) memcpy(&frame.count, bytes, sizeof(frame.count));
+        size_t payload = (size_t)frame.count * position_size(g_state.format);
+        frame.payload.assign(bytes + snapshot_prefix, bytes + snapshot_prefix + payload);
+        g_state.snapshots.writer->push(&frame);
+    } else {
+        g_state.snapshots.dropped++;
+    }
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    return true;
+}
+
+// collects the finished copies, oldest first so the file stays in order
+void collect_snapshots(bool wait) {
+    for (int i = 0; i < snapshot_slots; i++) {
+        int slot = (g_state.snapshots.next + i) % snapshot_slots;
+        if (g_state.snapshots.fences[slot] && !collect_snapshot(slot, wait)) break;
+    }
+}
+
+// queues a gpu copy of the positions just drawn, from buffer at offset
+void take_snapshot(GLuint buffer, GLintptr offset) {
+    int slot = g_state.snapshots.next;
+    if (!collect_snapshot(slot, false)) {
+        // the disk (or the gpu) is behind, skip rather than stall the frame
+        g_state.snapshots.dropped++;
+        return;
+    }
+
+    GLsizeiptr pos_size = (GLsizeiptr)g_state.num_particles * position_size(g_state.format);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, g_state.snapshots.buffers[slot]);
+    if (g_state.emitter.enabled) {
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.emitter.counters);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, snapshot_prefix, pos_size);
+    g_state.snapshots.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    g_state.snapshots.frames[slot] = g_state.snapshots.frame;
+    g_state.snapshots.times[slot] = g_state.clock.time;
+    g_state.snapshots.next = (slot + 1) % snapshot_slots;
+}
+
+// RENDER_INSTANCED and RENDER_PULLED: the particles in buffer from base on,
+// in chunks. gl_InstanceID starts over in every draw, so instanced chunks
+// point the position attribute at their first particle, pulled ones bind
+// the storage range around it
+void render_quads(GLuint buffer, int base) {
+    bool pulled = g_state.render == RENDER_PULLED;
+    int step = pulled ? g_state.sizes.max_pull : g_state.chunk_size;
+    GLsizeiptr stride = position_size(g_state.format);
+    if (pulled) glBindVertexArray(g_state.sizes.vao);
+    else glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (int first = 0; first < g_state.num_particles; first += step) {
+        int count = g_state.num_particles - first < step ? g_state.num_particles - first : step;
+        int start = base + first;
+        glUniform1i(g_locs.render.first, first);
+        if (pulled) {
+            int skip = start % g_state.sizes.align_particles;
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, (GLintptr)(start - skip) * stride,
+                              (GLsizeiptr)(skip + count) * stride);
+            glUniform1ui(g_locs.render.skip, (GLuint)skip);
+            glDrawArrays(GL_TRIANGLES, 0, 6 * count);
+        } else {
+            render_position_pointer((GLintptr)start * stride);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+        }
+    }
+}
+
+// blits the resolved splat image over the bound framebuffer, flipped: its
+// rows run top down like the positions
+void blit_splat_image() {
+    GLint read_framebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_state.splat.framebuffer);
+    glBlitFramebuffer(0, 0, window_width, window_height, 0, window_height, window_width, 0,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+}
+
+// RENDER_SPLAT: splats the positions in buffer from particle base on, then
+// resolves the counts into the image
+void render_splat(GLuint buffer, int base) {
+    glUseProgram(g_state.splat.splat_prog);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g_state.splat.counts);
+    int step = g_state.splat.max_dispatch;
+    for (int first = 0; first < g_state.num_particles; first += step) {
+        int count = g_state.num_particles - first < step ? g_state.num_particles - first : step;
+        int start = base + first;
+        int skip = start % g_state.splat.align_particles;
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, (GLintptr)(start - skip) * 2 * sizeof(float),
+                          (GLsizeiptr)(skip + count) * 2 * sizeof(float));
+        glUniform1ui(g_locs.splat.skip, (GLuint)skip);
+        glUniform1ui(g_locs.splat.count, (GLuint)count);
+        glDispatchCompute((count + splat_local_size - 1) / splat_local_size, 1, 1);
+    }
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(g_state.splat.resolve_prog);
+    glBindImageTexture(0, g_state.splat.image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glDispatchCompute((window_width + resolve_local_size - 1) / resolve_local_size,
+                      (window_height + resolve_local_size - 1) / resolve_local_size, 1);
+    // the blit reads the image, the next splat the cleared counts
+    glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    blit_splat_image();
+}
+
+// RENDER_SPLAT_CPU: splats the cpu's copy of the positions on the pool,
+// resolves by bands of rows and uploads the image. the threads share one
+// count buffer, the increments are atomic once there is more than one
+void render_splat_cpu() {
+    const float* positions = g_state.cpu.positions.data();
+    uint32_t* counts = g_state.splat.cpu_counts.data();
+    uint32_t* pixels = g_state.splat.pixels.data();
+    thread_pool* pool = g_state.cpu.pool.get();
+    bool shared = pool->size() > 1;
+
+    int num_tasks = (g_state.num_particles + cpu_task_particles - 1) / cpu_task_particles;
+    pool->parallel_for(num_tasks, [&](int task) {
+        int first = task * cpu_task_particles;
+        int last = g_state.num_particles - first < cpu_task_particles ? g_state.num_particles : first + cpu_task_particles;
+        splat_points(g_state.cpu.isa, positions, first, last, window_width, window_height, counts, shared);
+    });
+    const int band_rows = 16;
+    pool->parallel_for((window_height + band_rows - 1) / band_rows, [&](int band) {
+        int first_row = band * band_rows;
+        int last_row = window_height - first_row < band_rows ? window_height : first_row + band_rows;
+        splat_resolve(counts, window_width, first_row, last_row, pixels);
+    });
+
+    glBindTexture(GL_TEXTURE_2D, g_state.splat.image);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, window_width, window_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    blit_splat_image();
+}
+
+void render_frame(double frame_time) {
+    apply_shader_reloads();
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (g_state.reorder.every > 0 && ++g_state.reorder.frames >= g_state.reorder.every) {
+        g_state.reorder.frames = 0;
+        reorder_particles();
+    }
+
+    float delta_time;
+    int substeps = advance_clock(frame_time, &delta_time);
+    // a frame without a due step draws the latest state again. the threads
+    // backend still publishes it, into the next upload slot
+    bool updated = substeps > 0 || g_state.backend == BACKEND_THREADS;
+
+    begin_timed_frame();
+
+    begin_pass(PASS_UPDATE);
+    if (updated) {
+        switch (g_state.backend) {
+            case BACKEND_COMPUTE:
+                if (g_state.emitter.enabled) update_emitter(delta_time, substeps);
+                else if (g_state.interaction.enabled) update_interaction(delta_time, substeps);
+                else update_compute(delta_time, substeps);
+                break;
+            case BACKEND_CPU: update_cpu(delta_time, substeps); break;
+            case BACKEND_THREADS: update_threads(delta_time, substeps); break;
+            default: update_tf(delta_time, substeps); break;
+        }
+    }
+    end_pass(PASS_UPDATE);
+
+    // render updated particles
+    begin_pass(PASS_RENDER);
+    glUseProgram(g_state.render_prog);
+    int base = 0;
+    if (g_state.backend == BACKEND_THREADS) {
+        glBindVertexArray(g_state.upload.render_vao);
+        base = g_state.upload.slot * g_state.num_particles;
+    } else {
+        glBindVertexArray(g_state.vaos.render[updated ? ring_write_slot() : g_state.ring.read]);
+    }
+    GLuint drawn = g_state.backend == BACKEND_THREADS ? g_state.upload.buffer
+                 : g_state.buffers.pos[updated ? ring_write_slot() : g_state.ring.read];
+
+    float width = g_state.format == FORMAT_FLOAT ? window_width : 1.0f;
+    float height = g_state.format == FORMAT_FLOAT ? window_height : 1.0f;
+    float mvp[] = {
+        2.0f/width, 0.0f, 0.0f, 0.0f,
+        0.0f, -2.0f/height, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f, 1.0f,
+    };
+    glUniformMatrix4fv(g_locs.render.mvp, 1, GL_FALSE, mvp);
+    glUniform1i(g_locs.render.base, base);
+
+    if (g_state.render == RENDER_SPLAT) {
+        render_splat(drawn, base);
+    } else if (g_state.render == RENDER_SPLAT_CPU) {
+        render_splat_cpu();
+    } else if (g_state.render == RENDER_INSTANCED || g_state.render == RENDER_PULLED) {
+        render_quads(drawn, base);
+    } else if (g_state.emitter.enabled) {
+        // the count comes from the gpu side draw command
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, g_state.emitter.counters);
+        glDrawArraysIndirect(GL_POINTS, 0);
+    } else if (g_state.systems.count > 1) {
+        // one range per system, a single call where the driver has multi draw
+        if (GLAD_GL_EXT_multi_draw_arrays) {
+            glMultiDrawArraysEXT(GL_POINTS, g_state.systems.firsts.data(), g_state.systems.counts.data(), g_state.systems.count);
+        } else {
+            for (int i = 0; i < g_state.systems.count; i++) {
+                glDrawArrays(GL_POINTS, g_state.systems.firsts[i], g_state.systems.counts[i]);
+            }
+        }
+    } else {
+        for (int first = 0; first < g_state.num_particles; first += g_state.chunk_size) {
+            int count = g_state.num_particles - first < g_state.chunk_size ? g_state.num_particles - first : g_state.chunk_size;
+            glDrawArrays(GL_POINTS, base + first, count);
+        }
+    }
+    end_pass(PASS_RENDER);
+    end_timed_frame();
+
+    // snapshots copy what was just drawn, before its slot is fenced for reuse
+    if (g_state.snapshots.writer) {
+        collect_snapshots(false);
+        if (g_state.snapshots.frame % g_state.snapshots.every == 0) {
+            take_snapshot(drawn, g_state.backend == BACKEND_THREADS ? (GLintptr)base * 2 * sizeof(float) : 0);
+        }
+    }
+    g_state.snapshots.frame++;
+
+    if (g_state.backend == BACKEND_THREADS) {
+        g_state.upload.fences[g_state.upload.slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        g_state.upload.slot = (g_state.upload.slot + 1) % upload_slots;
+    }
+
+    if (!updated) return;
+
+    // advance the ring, the slot just drawn is fenced until the update
+    // that wraps around to it
+    int write = ring_write_slot();
+    if (g_state.ring.slots > 1 && (g_state.backend == BACKEND_TF || g_state.backend == BACKEND_CPU)) {
+        g_state.ring.fences[write] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    g_state.ring.read = write;
+}
+
+void set_shared_context(void (*make_current)(bool current)) {
+    g_state.reload.make_current = make_current;
+}
+
+static void render_loop() {
+    g_state.render_thread.make_current(true);
+    state_cache_reset();
+    state_cache_reset_counters();
+    frame_packet packet;
+    for (;;) {
+        if (g_state.render_thread.queue.pop(&packet)) g_state.render_thread.render_waits++;
+        if (packet.stop) break;
+        render_frame(packet.frame_time);
+        g_state.render_thread.present();
+    }
+    state_cache_counters calls = state_cache_get_counters();
+    for (int k = 0; k < num_state_kinds; k++) {
+        g_state.render_thread.state_calls.issued[k] += calls.issued[k];
+        g_state.render_thread.state_calls.elided[k] += calls.elided[k];
+    }
+    g_state.render_thread.make_current(false);
+}
+
+void start_render_thread(void (*make_current)(bool current), void (*present)()) {
+    if (g_state.render_thread.thread.joinable()) return;
+    g_state.render_thread.make_current = make_current;
+    g_state.render_thread.present = present;
+    g_state.render_thread.ran = true;
+    // a context is current on one thread at a time
+    make_current(false);
+    g_state.render_thread.thread = std::thread(render_loop);
+}
+
+void submit_frame(double frame_time) {
+    if (g_state.render_thread.queue.push({ frame_time, false })) g_state.render_thread.submit_waits++;
+}
+
+void stop_render_thread() {
+    if (!g_state.render_thread.thread.joinable()) return;
+    g_state.render_thread.queue.push({ 0.0, true });
+    g_state.render_thread.thread.join();
+    g_state.render_thread.make_current(true);
+    // the render thread moved the bindings on, the shadow of this one is stale
+    state_cache_reset();
+}
+
+void stop_shader_reload() {
+    if (g_state.reload.thread.joinable()) {
+        g_state.reload.watch.stop();
+        g_state.reload.thread.join();
+    }
+    g_state.reload.watch.close();
+    g_state.reload.watching = false;
+}
+
+void close_snapshots() {
+    if (!g_state.snapshots.writer) return;
+    collect_snapshots(true);
+    g_state.snapshots.writer->close();
+    glDeleteBuffers(snapshot_slots, g_state.snapshots.buffers);
+}
+
+sim_stats get_sim_stats() {
+    sim_stats stats = {};
+    stats.backend = g_state.backend;
+    stats.format = g_state.format;
+    stats.threads = 1;
+    stats.init = g_state.init.source;
+    stats.init_seconds = g_state.init.seconds;
+    stats.init_mismatches = g_state.init.mismatches;
+    stats.procedural_velocity = g_state.procedural_velocity;
+    stats.update_bytes = 0;
+    stats.record = g_state.records.layout.mode;
+    stats.render = g_state.render;
+    stats.programs = g_state.programs.count;
+    stats.program_cache = g_state.programs.cache_dir != nullptr;
+    stats.program_cache_hits = g_state.programs.cache_hits;
+    stats.program_cache_rejected = g_state.programs.rejected;
+    stats.program_seconds = g_state.programs.seconds;
+    stats.parallel_compile = g_state.programs.parallel;
+    stats.programs_ready = g_state.programs.ready;
+    stats.shader_reloads = g_state.reload.reloads;
+    stats.state_cache = state_cache_installed();
+    stats.state_calls = state_cache_get_counters();
+    for (int k = 0; k < num_state_kinds; k++) {
+        stats.state_calls.issued[k] += g_state.render_thread.state_calls.issued[k];
+        stats.state_calls.elided[k] += g_state.render_thread.state_calls.elided[k];
+    }
+    stats.render_thread = g_state.render_thread.ran;
+    stats.submit_waits = g_state.render_thread.submit_waits;
+    stats.render_waits = g_state.render_thread.render_waits;
+    {
+        std::lock_guard<std::mutex> lock(g_state.reload.mutex);
+        stats.shader_reload_failures = g_state.reload.failures;
+    }
+    stats.max_size = g_state.render == RENDER_SIZED_POINTS || g_state.render == RENDER_INSTANCED ||
+                     g_state.render == RENDER_PULLED ? g_state.sizes.max_size : 0.0f;
+    stats.point_size_limit = g_state.sizes.point_size_limit;
+    for (int s = 0; s < g_state.records.layout.num_streams; s++) {
+        stats.record_bytes += g_state.records.layout.streams[s].stride;
+    }
+    bool gpu_update = g_state.backend == BACKEND_TF || g_state.backend == BACKEND_COMPUTE;
+    if (gpu_update && !g_state.interaction.enabled && !g_state.emitter.enabled) {
+        // position in and out, plus the velocity fetch
+        stats.update_bytes = 2 * (int)position_size(g_state.format) + (g_state.procedural_velocity ? 0 : 2 * (int)sizeof(float));
+    }
+    if (stats.record != RECORD_NONE) stats.update_bytes = record_update_bytes(g_state.records.layout);
+    stats.reorder_every = g_state.reorder.every;
+    stats.reorders = g_state.reorder.passes;
+    stats.reorder_seconds = g_state.reorder.seconds;
+    stats.systems = g_state.systems.count;
+    stats.multi_draw = g_state.systems.count > 1 && GLAD_GL_EXT_multi_draw_arrays;
+    if (g_state.interaction.enabled) {
+        stats.interact_radius = g_state.interaction.radius;
+        stats.interact_cells = g_state.interaction.grid.cols * g_state.interaction.grid.rows;
+    }
+    if (g_state.snapshots.writer) {
+        stats.snapshot_every = g_state.snapshots.every;
+        stats.snapshots_written = g_state.snapshots.writer->frames_written();
+        stats.snapshots_dropped = g_state.snapshots.dropped;
+        stats.snapshot_bytes = g_state.snapshots.writer->bytes_written();
+    }
+
+    // pick up whatever finished since the last frame, without waiting
+    for (int slot = 0; slot < timer_frames; slot++) {
+        if (g_state.timers.enabled) collect_timers(slot);
+    }
+    if (g_state.emitter.enabled) {
+        GLuint draw_count = 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.emitter.counters);
+        const GLuint* counters = (const GLuint*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+        if (counters) draw_count = counters[0];
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        stats.live_particles = (int)draw_count;
+        stats.spawned = g_state.emitter.spawned;
+    }
+    stats.step = g_state.clock.step;
+    stats.sim_time = g_state.clock.time;
+    stats.sim_steps = g_state.clock.steps;
+    stats.most_substeps = g_state.clock.most_substeps;
+    stats.dropped_seconds = g_state.clock.dropped;
+    if (g_state.backend != BACKEND_THREADS) {
+        stats.ring_slots = g_state.ring.slots;
+        stats.ring_stalls = g_state.ring.stalls;
+    }
+    stats.gpu_timer = g_state.timers.enabled;
+    stats.timed_frames = g_state.timers.timed_frames;
+    stats.dropped_frames = g_state.timers.dropped_frames;
+    int timed = g_state.timers.timed_frames > 0 ? g_state.timers.timed_frames : 1;
+    int frames = g_state.timers.cpu_frames > 0 ? g_state.timers.cpu_frames : 1;
+    stats.update_gpu_ms = g_state.timers.gpu_ms[PASS_UPDATE] / timed;
+    stats.render_gpu_ms = g_state.timers.gpu_ms[PASS_RENDER] / timed;
+    stats.update_cpu_ms = g_state.timers.cpu_ms[PASS_UPDATE] / frames;
+    stats.render_cpu_ms = g_state.timers.cpu_ms[PASS_RENDER] / frames;
+
+    if (g_state.backend == BACKEND_COMPUTE) {
+        stats.workgroup_size = g_state.compute.workgroup_size;
+    }
+    if (g_state.backend == BACKEND_THREADS) {
+        stats.threads = g_state.cpu.pool->size();
+        stats.upload = g_state.upload.mapped ? "persistent" : "map_unsynchronized";
+        stats.upload_stalls = g_state.upload.stalls;
+        stats.upload_map_failures = g_state.upload.map_failures;
+    }
+    return stats;
+}
+
+void reset_sim_stats() {
+    if (g_state.timers.enabled) {
+        for (int slot = 0; slot < timer_frames; slot++) collect_timers(slot);
+    }
+    reset_timers();
+    g_state.upload.stalls = 0;
+    g_state.upload.map_failures = 0;
+    g_state.ring.stalls = 0;
+    g_state.clock.most_substeps = 0;
+    g_state.clock.dropped = 0.0;
+    g_state.reorder.passes = 0;
+    g_state.reorder.seconds = 0.0;
+    state_cache_reset_counters();
+    g_state.render_thread.ran = false;
+    g_state.render_thread.submit_waits = 0;
+    g_state.render_thread.render_waits = 0;
+    g_state.render_thread.state_calls = {};
+}
+
+bool save_checkpoint(const char* path) {
+    if (g_state.emitter.enabled) return false;
+
+    checkpoint_header header = {};
+    checkpoint_layout(&header, (uint32_t)g_state.num_particles, (uint32_t)position_size(g_state.format));
+    header.position_format = g_state.format;
+    header.rng_seed = g_state.init.seed;
+    header.rng_counter = (uint64_t)g_state.emitter.spawned;
+    header.sim_time = g_state.clock.time;
+    header.accumulator = g_state.clock.accumulator;
+    header.steps = g_state.clock.steps;
+
+    if (g_state.backend == BACKEND_CPU || g_state.backend == BACKEND_THREADS) {
+        return write_checkpoint(path, header, g_state.cpu.positions.data(), g_state.cpu.velocities.data());
+    }
+
+    // written straight from the read mappings of both buffers, procedural
+    // velocities are generated for the file
+    std::vector<float> generated;
+    if (g_state.procedural_velocity) generated = procedural_velocities();
+    glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[g_state.ring.read]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, g_state.buffers.vel);
+    const void* positions = glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)header.positions_size, GL_MAP_READ_BIT);
+    const void* velocities = g_state.procedural_velocity
+                           ? generated.data()
+                           : glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr)header.velocities_size, GL_MAP_READ_BIT);
+    bool ok = false;
+    if (positions && velocities) {
+        ok = write_checkpoint(path, header, positions, velocities);
+    } else {
+        std::cerr << "failed to map particle buffers" << std::endl;
+    }
+    if (positions) glUnmapBuffer(GL_COPY_READ_BUFFER);
+    if (velocities && !g_state.procedural_velocity) glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    return ok;
+}
+
+uint64_t hash_state() {
+    // the compaction order of the emitter is up to the gpu
+    if (g_state.emitter.enabled) return 0;
+
+    GLsizeiptr pos_size = (GLsizeiptr)g_state.num_particles * position_size(g_state.format);
+    const unsigned char* bytes = nullptr;
+    bool mapped = false;
+    std::vector<float> record_positions;
+    if (g_state.records.layout.mode != RECORD_NONE) {
+        // the positions out of the records, the same bytes as without
+        record_positions = read_record_field(RECORD_POSITION, g_state.ring.read);
+        if (record_positions.empty()) return 0;
+        bytes = (const unsigned char*)record_positions.data();
+        pos_size = (GLsizeiptr)(record_positions.size() * sizeof(float));
+    } else if (g_state.backend == BACKEND_CPU || g_state.backend == BACKEND_THREADS) {
+        bytes = (const unsigned char*)g_state.cpu.positions.data();
+    } else {
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[g_state.ring.read]);
+        bytes = (const unsigned char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, pos_size, GL_MAP_READ_BIT);
+        mapped = true;
+        if (!bytes) {
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            return 0;
+        }
+    }
+
+    // fnv-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (GLsizeiptr i = 0; i < pos_size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    if (mapped) glUnmapBuffer(GL_COPY_READ_BUFFER);
+    return hash;
+}
+
+// cpu version of one step of update_systems_vert_shader, the kernel runs
+// on positions relative to each system's origin
+void cpu_update_systems(cpu_isa isa, const float* old_positions, const float* velocities, float* new_positions,
+                        float delta_time) {
+    std::vector<float> local;
+    for (int s = 0; s < g_state.systems.count; s++) {
+        const float* bounds = &g_state.systems.bounds[(size_t)s * 4];
+        int first = g_state.systems.firsts[s];
+        int count = g_state.systems.counts[s];
+        local.resize((size_t)count * 2);
+        for (int i = 0; i < count; i++) {
+            local[2 * i + 0] = old_positions[2 * (first + i) + 0] - bounds[0];
+            local[2 * i + 1] = old_positions[2 * (first + i) + 1] - bounds[1];
+        }
+        cpu_update_positions(isa, local.data(), velocities + 2 * (size_t)first, local.data(), count,
+                             delta_time * g_state.systems.time_scales[s], bounds[2], bounds[3]);
+        for (int i = 0; i < count; i++) {
+            new_positions[2 * (first + i) + 0] = bounds[0] + local[2 * i + 0];
+            new_positions[2 * (first + i) + 1] = bounds[1] + local[2 * i + 1];
+        }
+    }
+}
+
+// compares gpu output with the cpu kernel run on the same input, the
+// positions are in g_state.format
+void compare_with_cpu(const void* old_positions, const float* velocities, const void* gpu_positions,
+                      float delta_time, cpu_isa isa, validation_result* result) {
+    std::vector<uint32_t> cpu_positions((size_t)g_state.num_particles * 2);
+    float units = (float)(1ull << position_bits(g_state.format));
+    switch (g_state.format) {
+        case FORMAT_FIXED32:
+            cpu_update_positions_fixed32((const uint32_t*)old_positions, velocities, cpu_positions.data(),
+                                         g_state.num_particles, delta_time, units / window_width, units / window_height);
+            break;
+        case FORMAT_FIXED16:
+            cpu_update_positions_fixed16((const uint32_t*)old_positions, velocities, cpu_positions.data(),
+                                         g_state.num_particles, delta_time, units / window_width, units / window_height);
+            break;
+        default:
+            if (g_state.systems.count > 1) {
+                cpu_update_systems(isa, (const float*)old_positions, velocities, (float*)cpu_positions.data(), delta_time);
+                break;
+            }
+            cpu_update_positions(isa, (const float*)old_positions, velocities, (float*)cpu_positions.data(),
+                                 g_state.num_particles, delta_time, window_width, window_height);
+            break;
+    }
+
+    for (int i = 0; i < g_state.num_particles; i++) {
+        float cpu_x, cpu_y, gpu_x, gpu_y;
+        decode_position(cpu_positions.data(), i, g_state.format, &cpu_x, &cpu_y);
+        decode_position(gpu_positions, i, g_state.format, &gpu_x, &gpu_y);
+        float dx = wrapped_distance(cpu_x, gpu_x, window_width);
+        float dy = wrapped_distance(cpu_y, gpu_y, window_height);
+        float error = dx > dy ? dx : dy;
+        if (error > result->max_error) result->max_error = error;
+        if (error > result->tolerance) result->mismatches++;
+    }
+}
+
+validation_result validate_update(float delta_time, cpu_isa isa) {
+    validation_result result = { g_state.num_particles, 0, 0.0f, cpu_kernel_tolerance };
+    if (g_state.emitter.enabled) {
+        std::cerr << "--validate does not cover the emission mode" << std::endl;
+        result.checked = 0;
+        return result;
+    }
+    GLsizeiptr buffer_size = (GLsizeiptr)g_state.num_particles * 2 * sizeof(float);
+    GLsizeiptr pos_size = (GLsizeiptr)g_state.num_particles * position_size(g_state.format);
+    const void* gpu_positions = nullptr;
+    const float* velocities = nullptr;
+    std::vector<float> generated;
+    if (g_state.procedural_velocity) generated = procedural_velocities();
+
+    if (g_state.backend == BACKEND_COMPUTE) {
+        // in place: keep the input, update, compare and put the input back.
+        // the interaction changes the velocities too, keep those as well
+        bool interact = g_state.interaction.enabled;
+        std::vector<float> old_positions((size_t)g_state.num_particles * 2);
+        std::vector<float> old_velocities(interact ? (size_t)g_state.num_particles * 2 : 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[0]);
+        const void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, 0, buffer_size, GL_MAP_READ_BIT);
+        if (mapped) memcpy(old_positions.data(), mapped, buffer_size);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        if (interact) {
+            glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.vel);
+            const void* mapped_velocities = glMapBufferRange(GL_COPY_READ_BUFFER, 0, buffer_size, GL_MAP_READ_BIT);
+            if (mapped_velocities) memcpy(old_velocities.data(), mapped_velocities, buffer_size);
+            else mapped = nullptr;
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+
+        if (interact) update_interaction(delta_time, 1);
+        else update_compute(delta_time, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+        gpu_positions = glMapBufferRange(GL_COPY_READ_BUFFER, 0, buffer_size, GL_MAP_READ_BIT);
+        velocities = g_state.procedural_velocity
+                   ? generated.data()
+                   : (const float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, GL_MAP_READ_BIT);
+        if (mapped && gpu_positions && velocities) {
+            if (interact) {
+                // the cpu interaction from the same input, then the same
+                // position step with the velocities it produced
+                std::vector<float> cpu_velocities = old_velocities;
+                interaction_grid grid;
+                interaction_grid_setup(&grid, g_state.interaction.radius, window_width, window_height, g_state.num_particles);
+                interaction_grid_build(&grid, old_positions.data(), g_state.num_particles);
+                interaction_accelerate(isa, grid, g_state.interaction.radius, g_state.interaction.strength, delta_time,
+                                       cpu_velocities.data(), 0, g_state.num_particles);
+                compare_with_cpu(old_positions.data(), cpu_velocities.data(), gpu_positions, delta_time, isa, &result);
+            } else {
+                compare_with_cpu(old_positions.data(), velocities, gpu_positions, delta_time, isa, &result);
+            }
+        } else {
+            std::cerr << "failed to map particle buffers for validation" << std::endl;
+            result.mismatches = result.checked;
+        }
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        if (!g_state.procedural_velocity) glUnmapBuffer(GL_ARRAY_BUFFER);
+
+        glBufferSubData(GL_COPY_READ_BUFFER, 0, buffer_size, old_positions.data());
+        if (interact) glBufferSubData(GL_ARRAY_BUFFER, 0, buffer_size, old_velocities.data());
+        return result;
+    }
+
+    // a gpu that fuses the step's multiply-add may round it the other way,
+    // which is one whole step in fixed16
+    if (g_state.format == FORMAT_FIXED16) {
+        result.tolerance += (window_width > window_height ? window_width : window_height) / 65536.0f;
+    }
+
+    // update into the next slot without advancing the ring, the next frame
+    // overwrites it
+    update_tf(delta_time, 1);
+
+    if (g_state.records.layout.mode != RECORD_NONE) {
+        std::vector<float> record_old = read_record_field(RECORD_POSITION, g_state.ring.read);
+        std::vector<float> record_new = read_record_field(RECORD_POSITION, ring_write_slot());
+        std::vector<float> record_velocities = read_record_field(RECORD_VELOCITY, g_state.ring.read);
+        if (!record_old.empty() && !record_new.empty() && !record_velocities.empty()) {
+            compare_with_cpu(record_old.data(), record_velocities.data(), record_new.data(), delta_time, isa, &result);
+        } else {
+            std::cerr << "failed to map particle buffers for validation" << std::endl;
+            result.mismatches = result.checked;
+        }
+        return result;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, g_state.buffers.pos[g_state.ring.read]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, g_state.buffers.pos[ring_write_slot()]);
+    glBindBuffer(GL_ARRAY_BUFFER, g_state.buffers.vel);
+    const void* old_positions = glMapBufferRange(GL_COPY_READ_BUFFER, 0, pos_size, GL_MAP_READ_BIT);
+    gpu_positions = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, pos_size, GL_MAP_READ_BIT);
+    velocities = g_state.procedural_velocity
+               ? generated.data()
+               : (const float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, GL_MAP_READ_BIT);
+
+    if (old_positions && gpu_positions && velocities) {
+        compare_with_cpu(old_positions, velocities, gpu_positions, delta_time, isa, &result);
+    } else {
+        std::cerr << "failed to map particle buffers for validation" << std::endl;
+        result.mismatches = result.checked;
+    }
+
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    if (!g_state.procedural_velocity) glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    return result;
+}
@@ -0,0 +1,262 @@
+#ifndef PARTICLES_PARTICLES_H_
+#define PARTICLES_PARTICLES_H_
+
+#include <glad/gles2.h>  // includes ES 3.0
+
+#include <cstdint>
+
+#include "cpu_kernel.h"
+#include "record_layout.h"
+#include "state_cache.h"
+
+// transform feedback particle simulation shared by the *_300es_tf demos.
+// the demos only differ in how they create the context, everything that
+// touches the particles lives here.
+
+// settings and constants
+const int window_width = 800;
+const int window_height = 600;
+const int max_particles = 50000000;
+
+// where the position update runs
+enum sim_backend {
+    BACKEND_AUTO,     // compute on ES 3.1+ contexts, transform feedback otherwise
+                      // (threads with --interact, which transform feedback cannot run)
+    BACKEND_TF,       // vertex shader + transform feedback, ring of position buffers
+    BACKEND_COMPUTE,  // compute shader, updates one storage buffer in place (ES 3.1),
+                      // the only backend with --lifetime
+    BACKEND_CPU,      // cpu_update_positions, then upload
+    BACKEND_THREADS,  // cpu_update_positions on a thread pool, written into a mapped ring
+};
+
+const char* sim_backend_name(sim_backend backend);
+
+// how positions are stored on the gpu, see cpu_kernel.h for the fixed
+// point encoding. the fixed formats need BACKEND_TF
+enum position_format {
+    FORMAT_FLOAT,    // vec2, 8 bytes, wrapped with mod()
+    FORMAT_FIXED32,  // uvec2 fractions of the canvas, 8 bytes, wraps on overflow
+    FORMAT_FIXED16,  // two 16 bit fractions packed in one uint, 4 bytes
+};
+
+const char* position_format_name(position_format format);
+
+// where the initial state is generated, see initial_state.h. both give the
+// same bits
+enum state_init {
+    INIT_AUTO,  // gpu when it can, cpu otherwise
+    INIT_GPU,   // transform feedback pass from gl_VertexID, nothing to upload. needs
+                // BACKEND_TF or BACKEND_COMPUTE, float positions and one system
+    INIT_CPU,   // simd on every hardware thread, then upload (the cpu backends keep
+                // their own copy anyway)
+};
+
+// how particles are drawn
+enum render_mode {
+    RENDER_POINTS,     // one GL_POINTS primitive per particle
+    // variable size, every particle its own size in [1, --max-size] pixels. not with --lifetime
+    // or --record
+    RENDER_SIZED_POINTS,  // GL_POINTS with gl_PointSize, clamped to the driver's point size range
+    RENDER_INSTANCED,     // a quad per instance, glDrawArraysInstanced with a per instance position
+    RENDER_PULLED,        // six vertices per particle fetching their position from a storage
+                          // buffer by gl_VertexID (ES 3.1, float positions)
+    RENDER_SPLAT,      // compute shader adds them to a count buffer with atomics, a second one
+                       // resolves it to an image that is blitted to the screen (ES 3.1, float
+                       // positions). see splat.h
+    RENDER_SPLAT_CPU,  // splat_points on the thread pool, the image is uploaded and blitted.
+                       // needs BACKEND_CPU or BACKEND_THREADS, the positions are on the cpu
+};
+
+const char* render_mode_name(render_mode mode);
+
+// command line options
+struct particle_options {
+    int num_particles = 2000;               // --particles <n>, up to max_particles
+    int chunk_size = 1 << 20;               // --chunk <n>, particles per draw call
+    sim_backend backend = BACKEND_AUTO;     // --backend auto|tf|compute|cpu|threads
+    int workgroup_size = 256;               // --workgroup <n>, compute local size
+    position_format format = FORMAT_FLOAT;  // --format float|fixed32|fixed16
+    int ring_slots = 3;                     // --ring <n>, position buffers the updates rotate through
+    int threads = 0;                        // --threads <n>, 0 = one per hardware thread
+    int reorder_every = 0;                  // --reorder <n>, z-order sort every n frames, 0 = never
+    cpu_isa isa = cpu_isa_detect();         // --cpu-isa scalar|sse2|avx2|avx512|auto
+    bool validate = false;                  // --validate: check the gpu against the cpu kernel
+    bool bench = false;                     // --bench: headless run, json report
+    int bench_frames = 1000;                // --frames <n>
+    int bench_warmup = 60;                  // --warmup <n>
+    double step = 1.0 / 60;                 // --step <seconds>, fixed timestep, 0 = one update per frame
+    int max_substeps = 8;                   // --max-substeps <n>, fixed steps run in one frame at most
+    double lifetime = 0.0;                  // --lifetime <seconds>, particles spawn and die, 0 = fixed population
+    double emit_rate = 0.0;                 // --emit <n>, spawns per second, 0 = particles / lifetime
+    state_init init = INIT_AUTO;            // --init auto|gpu|cpu
+    uint32_t seed = 0x5eed;                 // --seed <n>, of the initial state
+    bool procedural_velocity = false;       // --velocity buffer|procedural, recompute the constant
+                                            // velocities from the seed instead of storing them
+    record_mode record = RECORD_NONE;       // --record none|separate|interleaved, particles carry
+                                            // color and age too, see record_layout.h
+    render_mode render = RENDER_POINTS;     // --render points|sized-points|instanced|pulled|splat|splat-cpu
+    float max_size = 8.0f;                  // --max-size <pixels>, largest variable particle size
+    const char* program_cache_dir = nullptr;  // --program-cache <dir>, linked program binaries, see
+                                              // program_cache.h
+    int compile_threads = -1;               // --compile-threads <n>, KHR_parallel_shader_compile threads,
+                                            // -1 for the driver's choice, 0 to build one program at a time
+    bool state_cache = true;                // --state-cache on|off, drop redundant binds and uniforms,
+                                            // see state_cache.h
+    const char* shader_dir = nullptr;       // --shader-dir <dir>, edit the update and render shaders
+                                            // while it runs, see set_shared_context
+    bool render_thread = false;             // --render-thread: draw and swap on a thread of its own,
+                                            // see start_render_thread
+    int systems = 1;                        // --systems <n>, independent systems sharing the pool, tf only
+    float interact_radius = 0.0f;           // --interact <pixels>, repulsion range, 0 = independent particles
+    float interact_strength = 5000.0f;      // --strength <n>, repulsion at zero distance, pixels / s^2
+    const char* snapshot_path = nullptr;    // --snapshot <file>, stream positions to a file, see snapshot.h
+    int snapshot_every = 60;                // --snapshot-every <n>, frames between snapshots
+    const char* checkpoint_path = nullptr;  // --checkpoint <file>, save the state when the run ends
+    const char* restore_path = nullptr;     // --restore <file>, start from a checkpoint instead of the seed
+    double bench_delta_time = 1.0 / 60;     // --dt <seconds>, frame time fed to render_frame
+    double bench_app_ms = 0.0;              // --app-work <ms>, busy main thread time per frame, for
+                                            // the input handling and logic of an app
+};
+
+// returns false (after printing usage) on unknown or malformed arguments
+bool parse_options(int argc, char** argv, particle_options* opts);
+
+// --shader-dir: make_current(true) makes a context that shares objects with
+// the one of setup_graphics current on the calling thread, false releases
+// it. edited shaders are then rebuilt on a thread of their own and the
+// frames never wait for the compiler. without one they are rebuilt at the
+// start of the next frame. call before setup_graphics
+void set_shared_context(void (*make_current)(bool current));
+
+// compiles the programs and allocates the particle buffers once for the
+// requested count, needs a current GLES 3.0 context. returns false if the
+// programs do not link or the buffers cannot be allocated
+bool setup_graphics(const particle_options& opts);
+
+// advances the simulation by frame_time seconds (in fixed steps, batched
+// into one update pass, unless the step is 0) and draws into the bound
+// framebuffer, the caller swaps (or finishes) afterwards
+void render_frame(double frame_time);
+
+// --render-thread: moves render_frame and the swap to a thread of its own,
+// which takes over the context of setup_graphics. make_current(true) makes
+// that context current on the calling thread, false releases it; present
+// shows a drawn frame. the caller keeps handling events and hands frames
+// over with submit_frame, so it gets on with the next one while the last
+// is drawn. until stop_render_thread the context is not current on the
+// caller, call nothing else here in between
+void start_render_thread(void (*make_current)(bool current), void (*present)());
+
+// queues render_frame(frame_time) and present for the render thread, waits
+// while it is a whole queue of frames behind
+void submit_frame(double frame_time);
+
+// lets the render thread draw the frames still queued, joins it and makes
+// the context current on the caller again. does nothing if none runs
+void stop_render_thread();
+
+// stops watching --shader-dir and the thread rebuilding the shaders, which
+// releases the shared context. call it before the contexts go away
+void stop_shader_reload();
+
+// waits for the snapshots still in flight, then finishes and closes the
+// --snapshot file. call it once, before the context goes away
+void close_snapshots();
+
+// writes positions, velocities, rng state and clock to a checkpoint (see
+// checkpoint.h) that --restore starts from. reads the buffers back, so it
+// stalls. false with --lifetime or if the file cannot be written
+bool save_checkpoint(const char* path);
+
+// what the backend ended up doing, for reports
+struct sim_stats {
+    sim_backend backend;     // never BACKEND_AUTO, setup_graphics resolves it
+    int workgroup_size;      // BACKEND_COMPUTE only, 0 otherwise
+    position_format format;
+    int threads;             // threads updating particles, 1 unless BACKEND_THREADS
+    const char* upload;      // how BACKEND_THREADS hands positions to the gpu, null otherwise
+    int upload_stalls;       // frames that had to wait for the gpu to release a ring slot
+    int upload_map_failures; // frames whose slot could not be mapped, uploaded with glBufferSubData
+    int ring_slots;          // position buffers rotated through, 1 for BACKEND_COMPUTE,
+                             // 0 for BACKEND_THREADS (it draws from the upload ring)
+    int ring_stalls;         // updates that had to wait for the draw of their slot
+    double step;             // fixed timestep, 0 if every frame runs one update
+    double sim_time;         // simulated seconds since setup
+    long long sim_steps;     // steps since setup
+    int most_substeps;       // largest number of steps batched into one frame
+    double dropped_seconds;  // simulation time skipped by frames over max_substeps
+    int live_particles;      // --lifetime only: particles drawn last frame, read back from the
+                             // gpu, so get_sim_stats stalls in that mode
+    long long spawned;       // --lifetime only: spawn requests so far
+    const char* init;        // where the initial state came from: "gpu", "cpu", "checkpoint",
+                             // or "emitter" (--lifetime, nothing to generate)
+    double init_seconds;     // generating it, upload included
+    int init_mismatches;     // --validate with gpu init: particles whose initial state differs
+                             // from initial_state_generate, -1 if not checked
+    bool procedural_velocity;  // --velocity procedural, there is no velocity buffer
+    int update_bytes;        // buffer bytes the gpu update reads and writes per particle and
+                             // step, 0 for the cpu backends, --interact and --lifetime
+    record_mode record;      // layout of the particle records, RECORD_NONE without --record
+    int record_bytes;        // bytes of one record, all streams
+    render_mode render;      // how the particles were drawn
+    float max_size;          // variable sizes only: the largest particle size, 0 otherwise
+    float point_size_limit;  // largest gl_PointSize of the driver
+    int programs;            // programs created by setup_graphics
+    bool program_cache;      // --program-cache is in use, false if the driver has no binary formats
+    int program_cache_hits;  // of them loaded from it
+    int program_cache_rejected;  // cached binaries the driver refused, compiled instead
+    double program_seconds;  // creating the programs, compile and link or load
+    bool parallel_compile;   // all programs were submitted up front, KHR_parallel_shader_compile
+    int programs_ready;      // of them already complete when setup got to them
+    int shader_reloads;      // --shader-dir: programs rebuilt from edited files and swapped in
+    int shader_reload_failures;  // edits that did not compile or link, the old program stayed
+    bool render_thread;      // the last frames were drawn by start_render_thread's thread
+    int submit_waits;        // frames submit_frame had to wait for, the render thread was behind
+    int render_waits;        // frames the render thread had to wait for, the caller was behind
+    bool state_cache;        // --state-cache is on
+    state_cache_counters state_calls;  // gl calls it passed on and dropped, since the last reset
+    int reorder_every;       // frames between z-order sorts, 0 if disabled
+    int reorders;            // sorts done so far
+    double reorder_seconds;  // time spent in them, readback and upload included
+    int systems;             // particle systems in the pool
+    bool multi_draw;         // they are drawn with one glMultiDrawArraysEXT call
+    float interact_radius;   // --interact range, 0 if particles do not interact
+    int interact_cells;      // cells of its grid
+    int snapshot_every;      // frames between snapshots, 0 without --snapshot
+    int snapshots_written;   // frames in the file so far, since setup
+    int snapshots_dropped;   // snapshots skipped because every copy buffer was still in flight
+    uint64_t snapshot_bytes; // file size so far
+    bool gpu_timer;          // EXT_disjoint_timer_query, the gpu timings are 0 without it
+    int timed_frames;        // frames with gpu timings
+    int dropped_frames;      // frames whose queries were still in flight or disjoint
+    double update_gpu_ms;    // mean gpu time of the update pass
+    double render_gpu_ms;    // mean gpu time of the point draws (or the splat passes)
+    double update_cpu_ms;    // mean time to issue the update pass, or to run it on the cpu
+    double render_cpu_ms;    // mean time to issue the point draws, or to run splat-cpu
+};
+
+sim_stats get_sim_stats();
+
+// restarts the counters of sim_stats (timings, stalls, reorders), e.g.
+// after a warmup
+void reset_sim_stats();
+
+// hash of the current positions, equal for runs that simulated the same
+// steps from the same seed. reads the buffer back, so it stalls. 0 with
+// --lifetime, where the order of the particles is up to the gpu
+uint64_t hash_state();
+
+struct validation_result {
+    int checked;        // particles compared
+    int mismatches;     // particles off by more than tolerance
+    float max_error;    // largest wrap-aware distance, in pixels
+    float tolerance;    // cpu_kernel_tolerance, plus one step for fixed16
+};
+
+// runs one gpu update (compute for BACKEND_COMPUTE, transform feedback for
+// everything else) from the current state and the cpu kernel on the same
+// input and compares the two. reads buffers back, so it stalls; the
+// simulation itself does not advance
+validation_result validate_update(float delta_time, cpu_isa isa);
+
+#endif  // PARTICLES_PARTICLES_H_
@@ -0,0 +1,85 @@
+#include "program_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+uint64_t program_cache_key(const std::vector<std::string>& parts) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&](const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+    };
+    for (const std::string& part : parts) {
+        uint64_t length = part.size();
+        add(part.data(), part.size());
+        add(&length, sizeof(length));
+    }
+    return hash;
+}
+
+static std::string entry_path(const char* dir, uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.program", (unsigned long long)key);
+    return std::string(dir) + name;
+}
+
+bool program_cache_load(const char* dir, uint64_t key, uint32_t* format, std::vector<char>* binary) {
+    FILE* file = fopen(entry_path(dir, key).c_str(), "rb");
+    if (!file) return false;
+
+    program_cache_header header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, "PPROG001", 8) == 0 && header.version == program_cache_version &&
+              header.key == key && header.size > 0 && header.size < (1ull << 31);
+    if (ok) {
+        binary->resize((size_t)header.size);
+        ok = fread(binary->data(), 1, binary->size(), file) == binary->size();
+        *format = header.format;
+    }
+    fclose(file);
+    return ok;
+}
+
+bool program_cache_store(const char* dir, uint64_t key, uint32_t format, const void* binary, size_t size) {
+    std::string path = entry_path(dir, key);
+    std::string temp = path + "." + std::to_string((long long)getpid());
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+        std::cerr << "failed to create " << temp << ", is --program-cache an existing directory?" << std::endl;
+        return false;
+    }
+
+    program_cache_header header;
+    memcpy(header.magic, "PPROG001", 8);
+    header.version = program_cache_version;
+    header.format = format;
+    header.key = key;
+    header.size = size;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary, 1, size, file) == size;
+    if (fclose(file) != 0) ok = false;
+#ifdef _WIN32
+    // rename does not replace an existing file on windows
+    if (ok) remove(path.c_str());
+#endif
+    ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        std::cerr << "failed to write " << path << std::endl;
+        remove(temp.c_str());
+    }
+    return ok;
+}
+
+void program_cache_remove(const char* dir, uint64_t key) {
+    remove(entry_path(dir, key).c_str());
+}
@@ -0,0 +1,48 @@
+#ifndef PARTICLES_PROGRAM_CACHE_H_
+#define PARTICLES_PROGRAM_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// on disk cache of linked program binaries (--program-cache <dir>), the
+// bytes glGetProgramBinary returns. one file per program, named after its
+// key, all fields little endian:
+//
+//     header      program_cache_header
+//     binary      size bytes, to hand back to glProgramBinary with format
+//
+// the key hashes everything the binary depends on: the shader sources, the
+// transform feedback varyings and buffer mode, and the renderer and version
+// strings of the driver, so a driver update or an edited shader misses
+// instead of loading a stale binary. the driver may still reject a binary
+// it wrote itself, the caller then compiles and stores it again.
+
+const uint32_t program_cache_version = 1;
+
+struct program_cache_header {
+    char magic[8];      // "PPROG001"
+    uint32_t version;
+    uint32_t format;    // binary format enum of the driver
+    uint64_t key;       // of the file name, checked on load
+    uint64_t size;
+};
+
+// 64 bit fnv-1a of the parts in order. every part is followed by its
+// length, so moving bytes between neighbouring parts changes the key
+uint64_t program_cache_key(const std::vector<std::string>& parts);
+
+// reads the binary stored for key, false if there is none or the file is
+// not a cache entry for it
+bool program_cache_load(const char* dir, uint64_t key, uint32_t* format, std::vector<char>* binary);
+
+// writes the binary for key, through a temporary file renamed into place,
+// so concurrent runs never see half a file. false (after printing why) on
+// failure
+bool program_cache_store(const char* dir, uint64_t key, uint32_t format, const void* binary, size_t size);
+
+// drops the entry of key, for binaries the driver rejected
+void program_cache_remove(const char* dir, uint64_t key);
+
+#endif  // PARTICLES_PROGRAM_CACHE_H_
@@ -0,0 +1,72 @@
+#include "record_layout.h"
+
+#include <cstring>
+
+const record_field record_fields[num_record_fields] = {
+    { "position", "new_position", 2, true },
+    { "velocity", "new_velocity", 2, false },
+    { "color", "new_color", 4, false },
+    { "age", "new_age", 1, true },
+};
+
+const char* record_mode_name(record_mode mode) {
+    switch (mode) {
+        case RECORD_SEPARATE: return "separate";
+        case RECORD_INTERLEAVED: return "interleaved";
+        default: return "none";
+    }
+}
+
+void record_layout_build(record_layout* layout, record_mode mode) {
+    layout->mode = mode;
+    layout->num_streams = 0;
+    layout->num_outputs = 0;
+    if (mode == RECORD_INTERLEAVED) {
+        // fields in declaration order, which is also the capture order
+        record_stream& stream = layout->streams[layout->num_streams++];
+        stream.stride = 0;
+        stream.updated = true;
+        for (int f = 0; f < num_record_fields; f++) {
+            layout->stream_of[f] = 0;
+            layout->offset_of[f] = stream.stride;
+            stream.stride += record_fields[f].components * (int)sizeof(float);
+            layout->outputs[layout->num_outputs++] = record_fields[f].output;
+        }
+    } else {
+        for (int f = 0; f < num_record_fields; f++) {
+            record_stream& stream = layout->streams[layout->num_streams];
+            stream.stride = record_fields[f].components * (int)sizeof(float);
+            stream.updated = record_fields[f].updated;
+            layout->stream_of[f] = layout->num_streams++;
+            layout->offset_of[f] = 0;
+            if (stream.updated) layout->outputs[layout->num_outputs++] = record_fields[f].output;
+        }
+    }
+}
+
+int record_update_bytes(const record_layout& layout) {
+    int bytes = 0;
+    for (int s = 0; s < layout.num_streams; s++) {
+        bytes += layout.streams[s].stride;
+        if (layout.streams[s].updated) bytes += layout.streams[s].stride;
+    }
+    return bytes;
+}
+
+void record_gather(const record_layout& layout, int field, const void* stream, int count, float* out) {
+    int stride = layout.streams[layout.stream_of[field]].stride;
+    size_t size = record_fields[field].components * sizeof(float);
+    const char* bytes = (const char*)stream + layout.offset_of[field];
+    for (int i = 0; i < count; i++) {
+        memcpy((char*)out + i * size, bytes + (size_t)i * stride, size);
+    }
+}
+
+void record_scatter(const record_layout& layout, int field, const float* in, int count, void* stream) {
+    int stride = layout.streams[layout.stream_of[field]].stride;
+    size_t size = record_fields[field].components * sizeof(float);
+    char* bytes = (char*)stream + layout.offset_of[field];
+    for (int i = 0; i < count; i++) {
+        memcpy(bytes + (size_t)i * stride, (const char*)in + i * size, size);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef PARTICLES_RECORD_LAYOUT_H_
+#define PARTICLES_RECORD_LAYOUT_H_
+
+// particle records (--record): every particle carries the fields below
+// instead of just a position. one description drives the transform
+// feedback outputs and the update and render vertex arrays, in either
+// layout:
+//
+//     interleaved  one stream of whole records (array of structures), the
+//                  update writes every field with GL_INTERLEAVED_ATTRIBS,
+//                  the constant ones are copied through
+//     separate     one stream per field (structure of arrays), the update
+//                  only writes the updated fields, GL_SEPARATE_ATTRIBS. the
+//                  constant fields stay in one buffer for the whole ring
+//
+// updated streams have one buffer per ring slot. all fields are floats.
+
+enum record_mode {
+    RECORD_NONE,         // positions and velocities only, the plain pipeline
+    RECORD_SEPARATE,
+    RECORD_INTERLEAVED,
+};
+
+const char* record_mode_name(record_mode mode);
+
+enum record_field_index {
+    RECORD_POSITION,
+    RECORD_VELOCITY,
+    RECORD_COLOR,
+    RECORD_AGE,
+    num_record_fields,
+};
+
+struct record_field {
+    const char* name;    // input of the update and render shaders
+    const char* output;  // update shader output
+    int components;
+    bool updated;        // changed by the update, constant otherwise
+};
+
+extern const record_field record_fields[num_record_fields];
+
+struct record_stream {
+    int stride;          // bytes per particle
+    bool updated;        // written by the update, one buffer per ring slot
+};
+
+struct record_layout {
+    record_mode mode;
+    int num_streams;
+    record_stream streams[num_record_fields];
+    int stream_of[num_record_fields];
+    int offset_of[num_record_fields];    // bytes into the particle's part of the stream
+    int num_outputs;                     // transform feedback varyings, in capture order
+    const char* outputs[num_record_fields];
+};
+
+void record_layout_build(record_layout* layout, record_mode mode);
+
+// bytes the update reads and writes per particle and step
+int record_update_bytes(const record_layout& layout);
+
+// copies one field of count particles between a stream and a packed array
+// of its components
+void record_gather(const record_layout& layout, int field, const void* stream, int count, float* out);
+void record_scatter(const record_layout& layout, int field, const float* in, int count, void* stream);
+
+#endif  // PARTICLES_RECORD_LAYOUT_H_
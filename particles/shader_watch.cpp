@@ -0,0 +1,106 @@
+#include "shader_watch.h"
+
+#include <cstdio>
+#include <iostream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+shader_watch::~shader_watch() {
+    close();
+}
+
+#ifdef __linux__
+
+bool shader_watch::open(const std::string& dir) {
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_ < 0 || inotify_add_watch(inotify_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        pipe(wake_) != 0) {
+        std::cerr << "cannot watch " << dir << " for shader changes" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool shader_watch::changes(bool wait, std::vector<std::string>* names) {
+    names->clear();
+    if (inotify_ < 0) return false;
+    while (true) {
+        pollfd fds[2] = { { wake_[0], POLLIN, 0 }, { inotify_, POLLIN, 0 } };
+        if (poll(fds, 2, wait && names->empty() ? -1 : 0) < 0) continue;
+        if (fds[0].revents) return false;
+        if (!fds[1].revents) return true;
+
+        // a burst of events from one save arrives together, drain it all
+        alignas(inotify_event) char buffer[4096];
+        ssize_t size;
+        while ((size = read(inotify_, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t offset = 0; offset < size;) {
+                const inotify_event* event = (const inotify_event*)(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->len == 0) continue;
+                std::string name = event->name;
+                bool seen = false;
+                for (const std::string& other : *names) seen = seen || other == name;
+                if (!seen) names->push_back(name);
+            }
+        }
+    }
+}
+
+void shader_watch::stop() {
+    if (wake_[1] < 0) return;
+    char byte = 0;
+    if (write(wake_[1], &byte, 1) != 1) std::cerr << "failed to stop the shader watch" << std::endl;
+}
+
+void shader_watch::close() {
+    if (inotify_ >= 0) ::close(inotify_);
+    if (wake_[0] >= 0) ::close(wake_[0]);
+    if (wake_[1] >= 0) ::close(wake_[1]);
+    inotify_ = -1;
+    wake_[0] = wake_[1] = -1;
+}
+
+#else
+
+bool shader_watch::open(const std::string& dir) {
+    std::cerr << "watching " << dir << " needs inotify, shader files are only read at startup" << std::endl;
+    return false;
+}
+
+bool shader_watch::changes(bool, std::vector<std::string>* names) {
+    names->clear();
+    return false;
+}
+
+void shader_watch::stop() {}
+
+void shader_watch::close() {}
+
+#endif  // __linux__
+
+bool read_text_file(const std::string& path, std::string* text) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    text->clear();
+    char buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) text->append(buffer, size);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool write_text_file(const std::string& path, const std::string& text) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
@@ -0,0 +1,40 @@
+#ifndef PARTICLES_SHADER_WATCH_H_
+#define PARTICLES_SHADER_WATCH_H_
+
+#include <string>
+#include <vector>
+
+// watches the --shader-dir directory for shader files an editor wrote.
+// linux only (inotify), elsewhere open fails and the files are only read
+// at startup. editors either rewrite the file in place or write a new one
+// and rename it over the old, both count as a change of its name.
+class shader_watch {
+public:
+    shader_watch() = default;
+    ~shader_watch();
+
+    // starts watching dir, false (after printing why) if it cannot
+    bool open(const std::string& dir);
+
+    // the names (no directory) of the files written since the last call,
+    // each once. with wait, blocks until there is one or stop is called.
+    // false once stopped
+    bool changes(bool wait, std::vector<std::string>* names);
+
+    // wakes a thread blocked in changes, which then returns false
+    void stop();
+
+    void close();
+
+private:
+    int inotify_ = -1;
+    int wake_[2] = { -1, -1 };  // pipe, stop writes a byte into it
+};
+
+// whole file into text, false if it cannot be read
+bool read_text_file(const std::string& path, std::string* text);
+
+// text into a new file, false if it cannot be written
+bool write_text_file(const std::string& path, const std::string& text);
+
+#endif  // PARTICLES_SHADER_WATCH_H_
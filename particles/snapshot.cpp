@@ -0,0 +1,126 @@
+#include "snapshot.h"
+
+#include <cstring>
+#include <iostream>
+
+const size_t snapshot_header_size = 64;
+
+snapshot_writer::~snapshot_writer() {
+    close();
+}
+
+bool snapshot_writer::open(const std::string& path, uint32_t position_format, uint32_t capacity,
+                           float canvas_width, float canvas_height) {
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) {
+        std::cerr << "failed to create snapshot file " << path << std::endl;
+        return false;
+    }
+
+    unsigned char header[snapshot_header_size] = {};
+    memcpy(header, "PSNAP001", 8);
+    memcpy(header + 8, &snapshot_version, 4);
+    memcpy(header + 12, &position_format, 4);
+    memcpy(header + 16, &capacity, 4);
+    memcpy(header + 20, &canvas_width, 4);
+    memcpy(header + 24, &canvas_height, 4);
+    // frame_count at 28 and index_offset at 32 stay 0 until close
+    write(header, sizeof(header));
+
+    stop_ = false;
+    thread_ = std::thread(&snapshot_writer::writer_loop, this);
+    return true;
+}
+
+void snapshot_writer::push(snapshot_frame* frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(snapshot_frame());
+        snapshot_frame& queued = queue_.back();
+        queued.frame = frame->frame;
+        queued.sim_time = frame->sim_time;
+        queued.count = frame->count;
+        queued.payload.swap(frame->payload);
+    }
+    wake_.notify_one();
+}
+
+void snapshot_writer::close() {
+    if (!file_) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+
+    // index, then patch the header to point at it
+    uint64_t index_offset = offset_;
+    uint32_t frame_count = (uint32_t)index_.size();
+    write("INDX", 4);
+    write(&frame_count, 4);
+    for (const index_entry& entry : index_) {
+        write(&entry.frame, 8);
+        write(&entry.sim_time, 8);
+        write(&entry.offset, 8);
+    }
+    if (fseek(file_, 28, SEEK_SET) == 0) {
+        fwrite(&frame_count, 4, 1, file_);
+        fwrite(&index_offset, 8, 1, file_);
+    } else {
+        failed_ = true;
+    }
+
+    if (fclose(file_) != 0) failed_ = true;
+    file_ = nullptr;
+    if (failed_) std::cerr << "failed to write the snapshot file" << std::endl;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_written_ = offset_;
+}
+
+int snapshot_writer::frames_written() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_written_;
+}
+
+uint64_t snapshot_writer::bytes_written() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_written_;
+}
+
+void snapshot_writer::writer_loop() {
+    for (;;) {
+        snapshot_frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;  // stopping and drained
+            frame.frame = queue_.front().frame;
+            frame.sim_time = queue_.front().sim_time;
+            frame.count = queue_.front().count;
+            frame.payload.swap(queue_.front().payload);
+            queue_.pop_front();
+        }
+
+        index_entry entry = { frame.frame, frame.sim_time, offset_ };
+        uint64_t payload_size = frame.payload.size();
+        write("FRAM", 4);
+        write(&frame.count, 4);
+        write(&frame.frame, 8);
+        write(&frame.sim_time, 8);
+        write(&payload_size, 8);
+        write(frame.payload.data(), frame.payload.size());
+        index_.push_back(entry);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        frames_written_++;
+        bytes_written_ = offset_;
+    }
+}
+
+void snapshot_writer::write(const void* data, size_t size) {
+    if (fwrite(data, 1, size, file_) != size) failed_ = true;
+    offset_ += size;
+}
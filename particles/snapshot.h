@@ -0,0 +1,81 @@
+#ifndef PARTICLES_SNAPSHOT_H_
+#define PARTICLES_SNAPSHOT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// streaming particle snapshot file. all fields little endian:
+//
+//     header   "PSNAP001", u32 version (1), u32 position_format,
+//              u32 capacity, f32 canvas_width, f32 canvas_height,
+//              u32 frame_count, u64 index_offset, 24 reserved bytes (64 in total)
+//     frames   "FRAM", u32 count, u64 frame, f64 sim_time, u64 payload_size,
+//              payload (count positions in position_format)
+//     index    "INDX", u32 frame_count, then per frame
+//              u64 frame, f64 sim_time, u64 offset of its "FRAM"
+//
+// frame_count and index_offset are written when the file is closed. a file
+// that was not closed still reads front to back, chunk by chunk.
+
+const uint32_t snapshot_version = 1;
+
+struct snapshot_frame {
+    uint64_t frame;
+    double sim_time;
+    uint32_t count;
+    std::vector<unsigned char> payload;
+};
+
+// appends frames on its own thread, so the caller never waits for the disk
+class snapshot_writer {
+public:
+    snapshot_writer() = default;
+    ~snapshot_writer();
+
+    // writes the header and starts the thread, false if the file cannot be
+    // created
+    bool open(const std::string& path, uint32_t position_format, uint32_t capacity,
+              float canvas_width, float canvas_height);
+
+    // queues a frame, the payload is moved out
+    void push(snapshot_frame* frame);
+
+    // writes what is queued, the index and the final header, then stops
+    void close();
+
+    // frames written and bytes in the file so far
+    int frames_written();
+    uint64_t bytes_written();
+
+private:
+    void writer_loop();
+    void write(const void* data, size_t size);
+
+    FILE* file_ = nullptr;
+    std::thread thread_;
+
+    std::mutex mutex_;                  // guards the fields below
+    std::condition_variable wake_;
+    std::deque<snapshot_frame> queue_;
+    bool stop_ = false;
+    int frames_written_ = 0;
+    uint64_t bytes_written_ = 0;
+
+    // only touched by the writer thread until close joins it
+    struct index_entry {
+        uint64_t frame;
+        double sim_time;
+        uint64_t offset;
+    };
+    std::vector<index_entry> index_;
+    uint64_t offset_ = 0;
+    bool failed_ = false;
+};
+
+#endif  // PARTICLES_SNAPSHOT_H_
@@ -0,0 +1,79 @@
+#include "spatial_sort.h"
+
+#include <cstring>
+
+// particles per histogram/scatter task
+const int radix_task_size = 1 << 16;
+const int radix_bits = 8;
+const int radix_buckets = 1 << radix_bits;
+
+// spreads the low 16 bits of v over the even bits
+static uint32_t part_1by1(uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+static uint32_t quantize(float v, float canvas_size) {
+    const int cells = 1 << morton_axis_bits;
+    int q = (int)(v / canvas_size * cells);
+    if (q < 0) q = 0;
+    if (q >= cells) q = cells - 1;
+    return (uint32_t)q;
+}
+
+uint32_t morton_key(float x, float y, float canvas_width, float canvas_height) {
+    return part_1by1(quantize(x, canvas_width)) | (part_1by1(quantize(y, canvas_height)) << 1);
+}
+
+void radix_sort_order(thread_pool* pool, const uint32_t* keys, int count, int key_bits,
+                      std::vector<uint32_t>* order) {
+    std::vector<uint32_t> keys_in(keys, keys + count), keys_out(count);
+    std::vector<uint32_t> order_in(count), order_out(count);
+    for (int i = 0; i < count; i++) order_in[i] = (uint32_t)i;
+
+    int num_tasks = (count + radix_task_size - 1) / radix_task_size;
+    std::vector<uint32_t> offsets((size_t)num_tasks * radix_buckets);
+
+    for (int shift = 0; shift < key_bits; shift += radix_bits) {
+        // every task counts the digits of its slice
+        pool->parallel_for(num_tasks, [&](int task) {
+            uint32_t* hist = &offsets[(size_t)task * radix_buckets];
+            memset(hist, 0, radix_buckets * sizeof(uint32_t));
+            int first = task * radix_task_size;
+            int last = first + radix_task_size < count ? first + radix_task_size : count;
+            for (int i = first; i < last; i++) {
+                hist[(keys_in[i] >> shift) & (radix_buckets - 1)]++;
+            }
+        });
+
+        // bucket major prefix sum, so equal digits keep their task order
+        uint32_t sum = 0;
+        for (int digit = 0; digit < radix_buckets; digit++) {
+            for (int task = 0; task < num_tasks; task++) {
+                uint32_t n = offsets[(size_t)task * radix_buckets + digit];
+                offsets[(size_t)task * radix_buckets + digit] = sum;
+                sum += n;
+            }
+        }
+
+        pool->parallel_for(num_tasks, [&](int task) {
+            uint32_t* offset = &offsets[(size_t)task * radix_buckets];
+            int first = task * radix_task_size;
+            int last = first + radix_task_size < count ? first + radix_task_size : count;
+            for (int i = first; i < last; i++) {
+                uint32_t dst = offset[(keys_in[i] >> shift) & (radix_buckets - 1)]++;
+                keys_out[dst] = keys_in[i];
+                order_out[dst] = order_in[i];
+            }
+        });
+
+        keys_in.swap(keys_out);
+        order_in.swap(order_out);
+    }
+
+    order->swap(order_in);
+}
@@ -0,0 +1,25 @@
+#ifndef PARTICLES_SPATIAL_SORT_H_
+#define PARTICLES_SPATIAL_SORT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+
+// z-order (morton) sorting of particles, so that consecutive points land
+// close together on screen. neighbouring keys share a tile of the
+// rasterizer and the same framebuffer cache lines.
+
+// bits per axis of morton_key, the key itself is twice as wide
+const int morton_axis_bits = 10;
+
+// interleaves the positions quantized to morton_axis_bits, y in the odd bits
+uint32_t morton_key(float x, float y, float canvas_width, float canvas_height);
+
+// stable lsd radix sort, 8 bits per pass over the low key_bits bits of
+// keys. fills order with the permutation: element i of the sorted sequence
+// is element order[i] of the input. histograms and scatters run on the pool
+void radix_sort_order(thread_pool* pool, const uint32_t* keys, int count, int key_bits,
+                      std::vector<uint32_t>* order);
+
+#endif  // PARTICLES_SPATIAL_SORT_H_
@@ -0,0 +1,126 @@
+#include "splat.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PARTICLES_X86_64 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+// particles converted per batch, then scattered
+const int splat_batch = 512;
+
+// the top left cell of each particle, x0 and y0 interleaved like the
+// positions. the positions are on the canvas, so p + 0.5 is positive and
+// truncating it is floor: floor(p - 0.5) = int(p + 0.5) - 1
+static void corners_scalar(const float* positions, int count, int32_t* corners) {
+    for (int k = 0; k < 2 * count; k++) {
+        corners[k] = (int32_t)(positions[k] + 0.5f) - 1;
+    }
+}
+
+#ifdef PARTICLES_X86_64
+
+// the simd paths convert the interleaved components without splitting them
+static int corners_sse2(const float* positions, int count, int32_t* corners) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i one = _mm_set1_epi32(1);
+    int k = 0;
+    for (; k + 4 <= 2 * count; k += 4) {
+        __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(positions + k), half));
+        _mm_storeu_si128((__m128i*)(corners + k), _mm_sub_epi32(c, one));
+    }
+    return k / 2;
+}
+
+TARGET_AVX2 static int corners_avx2(const float* positions, int count, int32_t* corners) {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256i one = _mm256_set1_epi32(1);
+    int k = 0;
+    for (; k + 8 <= 2 * count; k += 8) {
+        __m256i c = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_loadu_ps(positions + k), half));
+        _mm256_storeu_si256((__m256i*)(corners + k), _mm256_sub_epi32(c, one));
+    }
+    return k / 2;
+}
+
+// the maskz form with every lane set, gcc warns about the undefined
+// pass-through operand of the unmasked one
+static const __mmask16 all_lanes = 0xffff;
+
+TARGET_AVX512 static int corners_avx512(const float* positions, int count, int32_t* corners) {
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512i one = _mm512_set1_epi32(1);
+    int k = 0;
+    for (; k + 16 <= 2 * count; k += 16) {
+        __m512i c = _mm512_maskz_cvttps_epi32(all_lanes, _mm512_add_ps(_mm512_loadu_ps(positions + k), half));
+        _mm512_storeu_si512(corners + k, _mm512_sub_epi32(c, one));
+    }
+    return k / 2;
+}
+
+#endif  // PARTICLES_X86_64
+
+static void corners(cpu_isa isa, const float* positions, int count, int32_t* out) {
+    // the simd loops stop at a multiple of their width, the scalar loop
+    // finishes the tail
+    int done = 0;
+    switch (isa) {
+#ifdef PARTICLES_X86_64
+        case CPU_ISA_SSE2: done = corners_sse2(positions, count, out); break;
+        case CPU_ISA_AVX2: done = corners_avx2(positions, count, out); break;
+        case CPU_ISA_AVX512: done = corners_avx512(positions, count, out); break;
+#endif
+        default: break;
+    }
+    corners_scalar(positions + 2 * done, count - done, out + 2 * done);
+}
+
+// the increments go through memory in particle order, there is nothing for
+// simd to gain there: lanes of one vector may hit the same cell
+template <bool shared>
+static void scatter(const int32_t* corners, int count, int width, int height, uint32_t* counts) {
+    for (int i = 0; i < count; i++) {
+        int x0 = corners[2 * i + 0];
+        int y0 = corners[2 * i + 1];
+        for (int y = y0; y < y0 + 2; y++) {
+            if ((unsigned)y >= (unsigned)height) continue;
+            for (int x = x0; x < x0 + 2; x++) {
+                if ((unsigned)x >= (unsigned)width) continue;
+                uint32_t* cell = counts + (size_t)y * width + x;
+                if (shared) __atomic_fetch_add(cell, 1u, __ATOMIC_RELAXED);
+                else (*cell)++;
+            }
+        }
+    }
+}
+
+void splat_points(cpu_isa isa, const float* positions, int first, int last,
+                  int width, int height, uint32_t* counts, bool shared) {
+    if (!cpu_isa_supported(isa)) isa = cpu_isa_detect();
+
+    int32_t batch[2 * splat_batch];
+    for (int i = first; i < last; i += splat_batch) {
+        int count = last - i < splat_batch ? last - i : splat_batch;
+        corners(isa, positions + 2 * (size_t)i, count, batch);
+        if (shared) scatter<true>(batch, count, width, height, counts);
+        else scatter<false>(batch, count, width, height, counts);
+    }
+}
+
+void splat_resolve(uint32_t* counts, int width, int first_row, int last_row, uint32_t* pixels) {
+    size_t first = (size_t)first_row * width;
+    size_t last = (size_t)last_row * width;
+    for (size_t i = first; i < last; i++) {
+        pixels[i] = counts[i] ? splat_point_pixel : splat_clear_pixel;
+    }
+    memset(counts + first, 0, (last - first) * sizeof(uint32_t));
+}
@@ -0,0 +1,36 @@
+#ifndef PARTICLES_SPLAT_H_
+#define PARTICLES_SPLAT_H_
+
+#include <cstdint>
+
+#include "cpu_kernel.h"
+
+// software point rendering (--render splat-cpu), cpu side of the splat
+// compute shaders. instead of rasterizing a 2x2 point per particle, every
+// particle adds one to the four cells of a canvas sized count buffer it
+// covers, then a resolve turns the counts into pixels:
+//
+//     x0 = floor(x - 0.5), y0 = floor(y - 0.5)
+//     counts[(y0 + j) * width + x0 + i] += 1      for i, j in {0, 1}, on the canvas
+//
+// the same pixels gl_PointSize = 2.0 covers, up to ties at pixel edges.
+// rows run top down like the positions, the resolved image is flipped
+// when it is blitted to the screen.
+
+// pixel of a covered cell and of an empty one, rgba8, the point color and
+// the clear color of the point renderer
+const uint32_t splat_point_pixel = 0xff0000ffu;
+const uint32_t splat_clear_pixel = 0xff1a1a1au;
+
+// adds particles [first, last) of the interleaved positions to counts.
+// shared uses atomic increments, for several threads splatting into the
+// same buffer. falls back to the widest supported path if isa is not
+// supported by this cpu
+void splat_points(cpu_isa isa, const float* positions, int first, int last,
+                  int width, int height, uint32_t* counts, bool shared);
+
+// writes rows [first_row, last_row) of the resolved image and zeroes their
+// counts for the next frame
+void splat_resolve(uint32_t* counts, int width, int first_row, int last_row, uint32_t* pixels);
+
+#endif  // PARTICLES_SPLAT_H_
@@ -0,0 +1,76 @@
+#ifndef PARTICLES_SPSC_RING_H_
+#define PARTICLES_SPSC_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+// bounded queue between exactly one producer thread and one consumer
+// thread, without locks: each side owns one index and only reads the
+// other's. the indices count up forever and pick a slot modulo capacity,
+// so full (tail - head == capacity) and empty (tail == head) differ without
+// a spare slot. capacity is a power of two so that stays true across the
+// wrap of size_t.
+//
+// try_push and try_pop never block. push and pop wait for space or an item:
+// they spin briefly, then yield, then sleep in short naps, so a side that
+// waits a whole frame does not keep a core busy.
+template <typename T, size_t capacity>
+class spsc_ring {
+    static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // producer only
+    bool try_push(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == capacity) return false;
+        items_[tail % capacity] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only
+    bool try_pop(T* item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_.load(std::memory_order_acquire) == head) return false;
+        *item = items_[head % capacity];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // true if it had to wait for the consumer
+    bool push(const T& item) {
+        for (int attempt = 0; ; attempt++) {
+            if (try_push(item)) return attempt > 0;
+            back_off(attempt);
+        }
+    }
+
+    // true if it had to wait for the producer
+    bool pop(T* item) {
+        for (int attempt = 0; ; attempt++) {
+            if (try_pop(item)) return attempt > 0;
+            back_off(attempt);
+        }
+    }
+
+    // either side, a snapshot that may be stale by the time it returns
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+private:
+    static void back_off(int attempt) {
+        if (attempt < 64) return;
+        if (attempt < 128) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    // on lines of their own, the two sides write different indices
+    alignas(64) std::atomic<size_t> head_{0};  // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail_{0};  // next slot to push, written by the producer
+    alignas(64) T items_[capacity];
+};
+
+#endif  // PARTICLES_SPSC_RING_H_
@@ -0,0 +1,453 @@
+#include "state_cache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const char* state_kind_name(state_kind kind) {
+    switch (kind) {
+        case STATE_PROGRAM: return "program";
+        case STATE_VERTEX_ARRAY: return "vertex_array";
+        case STATE_BUFFER: return "buffer";
+        case STATE_TRANSFORM_FEEDBACK: return "transform_feedback";
+        case STATE_ENABLE: return "enable";
+        case STATE_UNIFORM: return "uniform";
+        default: return "unknown";
+    }
+}
+
+// the uniform functions that are cached. gl fixes the type of a location,
+// the type only tells apart values of the same bits
+enum uniform_type { UNIFORM_1F, UNIFORM_1I, UNIFORM_1UI, UNIFORM_2F, UNIFORM_2I, UNIFORM_2UI, UNIFORM_4UI, UNIFORM_MATRIX4F };
+
+struct uniform_value {
+    bool known;
+    uniform_type type;
+    uint32_t bits[16];
+};
+
+// locations past this go straight to the driver, drivers hand out small
+// ones but nothing promises it
+const GLint max_cached_location = 1024;
+
+// buffer targets with a shadow, see buffer_slot
+const int num_buffer_slots = 10;
+
+struct shadow_state {
+    bool program_known = false;
+    GLuint program = 0;
+    std::vector<uniform_value>* uniforms = nullptr;  // of program, null if not cached
+    bool vertex_array_known = false;
+    GLuint vertex_array = 0;
+    bool transform_feedback_known = false;
+    GLuint transform_feedback = 0;
+    bool buffer_known[num_buffer_slots] = {};
+    GLuint buffers[num_buffer_slots] = {};
+    std::vector<std::pair<GLenum, bool>> enabled;  // caps seen so far
+    std::unordered_map<GLuint, std::vector<uniform_value>> program_uniforms;  // by location
+    state_cache_counters counters = {};
+};
+
+static thread_local shadow_state shadow;
+
+// the driver's entry points
+static struct {
+    PFNGLUSEPROGRAMPROC use_program;
+    PFNGLBINDVERTEXARRAYPROC bind_vertex_array;
+    PFNGLBINDBUFFERPROC bind_buffer;
+    PFNGLBINDBUFFERBASEPROC bind_buffer_base;
+    PFNGLBINDBUFFERRANGEPROC bind_buffer_range;
+    PFNGLBINDTRANSFORMFEEDBACKPROC bind_transform_feedback;
+    PFNGLENABLEPROC enable;
+    PFNGLDISABLEPROC disable;
+    PFNGLDELETEPROGRAMPROC delete_program;
+    PFNGLDELETEBUFFERSPROC delete_buffers;
+    PFNGLDELETEVERTEXARRAYSPROC delete_vertex_arrays;
+    PFNGLDELETETRANSFORMFEEDBACKSPROC delete_transform_feedbacks;
+    PFNGLLINKPROGRAMPROC link_program;
+    PFNGLPROGRAMBINARYPROC program_binary;
+    PFNGLUNIFORM1FPROC uniform1f;
+    PFNGLUNIFORM1IPROC uniform1i;
+    PFNGLUNIFORM1UIPROC uniform1ui;
+    PFNGLUNIFORM2FPROC uniform2f;
+    PFNGLUNIFORM2IPROC uniform2i;
+    PFNGLUNIFORM2UIPROC uniform2ui;
+    PFNGLUNIFORM4UIPROC uniform4ui;
+    PFNGLUNIFORMMATRIX4FVPROC uniform_matrix4fv;
+    PFNGLPROGRAMUNIFORM1FPROC program_uniform1f;
+    PFNGLPROGRAMUNIFORM1IPROC program_uniform1i;
+    PFNGLPROGRAMUNIFORM1UIPROC program_uniform1ui;
+    PFNGLPROGRAMUNIFORM2FPROC program_uniform2f;
+    PFNGLPROGRAMUNIFORM2IPROC program_uniform2i;
+    PFNGLPROGRAMUNIFORM2UIPROC program_uniform2ui;
+    PFNGLPROGRAMUNIFORM4UIPROC program_uniform4ui;
+    PFNGLPROGRAMUNIFORMMATRIX4FVPROC program_uniform_matrix4fv;
+} real;
+
+static bool installed = false;
+
+// counts a call, true if it has to reach the driver
+static bool issue(state_kind kind, bool changed) {
+    if (changed) shadow.counters.issued[kind]++;
+    else shadow.counters.elided[kind]++;
+    return changed;
+}
+
+static int buffer_slot(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_COPY_READ_BUFFER: return 1;
+        case GL_COPY_WRITE_BUFFER: return 2;
+        case GL_PIXEL_PACK_BUFFER: return 3;
+        case GL_PIXEL_UNPACK_BUFFER: return 4;
+        case GL_UNIFORM_BUFFER: return 5;
+        case GL_SHADER_STORAGE_BUFFER: return 6;
+        case GL_ATOMIC_COUNTER_BUFFER: return 7;
+        case GL_DRAW_INDIRECT_BUFFER: return 8;
+        case GL_DISPATCH_INDIRECT_BUFFER: return 9;
+        default: return -1;
+    }
+}
+
+// the cached uniforms of program, null for no program
+static std::vector<uniform_value>* uniforms_of(GLuint program) {
+    return program ? &shadow.program_uniforms[program] : nullptr;
+}
+
+// true if value is not what location of the program holds, which it then
+// becomes. gl ignores location -1
+static bool uniform_changed(std::vector<uniform_value>* uniforms, GLint location, uniform_type type,
+                            const void* value, size_t size) {
+    if (location < 0) return false;
+    if (!uniforms || location >= max_cached_location) return true;
+    if ((size_t)location >= uniforms->size()) uniforms->resize(location + 1);
+    uniform_value& cached = (*uniforms)[location];
+    if (cached.known && cached.type == type && memcmp(cached.bits, value, size) == 0) return false;
+    cached.known = true;
+    cached.type = type;
+    memcpy(cached.bits, value, size);
+    return true;
+}
+
+static void forget_uniform(std::vector<uniform_value>* uniforms, GLint location) {
+    if (uniforms && location >= 0 && (size_t)location < uniforms->size()) (*uniforms)[location].known = false;
+}
+
+// glUniform* set the current program, known once glUseProgram went through
+// here
+static std::vector<uniform_value>* current_uniforms() {
+    return shadow.program_known ? shadow.uniforms : nullptr;
+}
+
+static void GLAD_API_PTR cached_use_program(GLuint program) {
+    shadow_state& s = shadow;
+    if (!issue(STATE_PROGRAM, !s.program_known || s.program != program)) return;
+    real.use_program(program);
+    s.program_known = true;
+    s.program = program;
+    s.uniforms = uniforms_of(program);
+}
+
+static void GLAD_API_PTR cached_bind_vertex_array(GLuint array) {
+    shadow_state& s = shadow;
+    if (!issue(STATE_VERTEX_ARRAY, !s.vertex_array_known || s.vertex_array != array)) return;
+    real.bind_vertex_array(array);
+    s.vertex_array_known = true;
+    s.vertex_array = array;
+}
+
+static void GLAD_API_PTR cached_bind_buffer(GLenum target, GLuint buffer) {
+    shadow_state& s = shadow;
+    int slot = buffer_slot(target);
+    if (slot < 0) {
+        issue(STATE_BUFFER, true);
+        real.bind_buffer(target, buffer);
+        return;
+    }
+    if (!issue(STATE_BUFFER, !s.buffer_known[slot] || s.buffers[slot] != buffer)) return;
+    real.bind_buffer(target, buffer);
+    s.buffer_known[slot] = true;
+    s.buffers[slot] = buffer;
+}
+
+// the indexed binds also set the generic binding of their target
+static void GLAD_API_PTR cached_bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+    real.bind_buffer_base(target, index, buffer);
+    int slot = buffer_slot(target);
+    if (slot < 0) return;
+    shadow.buffer_known[slot] = true;
+    shadow.buffers[slot] = buffer;
+}
+
+static void GLAD_API_PTR cached_bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+                                                  GLsizeiptr size) {
+    real.bind_buffer_range(target, index, buffer, offset, size);
+    int slot = buffer_slot(target);
+    if (slot < 0) return;
+    shadow.buffer_known[slot] = true;
+    shadow.buffers[slot] = buffer;
+}
+
+static void GLAD_API_PTR cached_bind_transform_feedback(GLenum target, GLuint id) {
+    shadow_state& s = shadow;
+    if (!issue(STATE_TRANSFORM_FEEDBACK, !s.transform_feedback_known || s.transform_feedback != id)) return;
+    real.bind_transform_feedback(target, id);
+    s.transform_feedback_known = true;
+    s.transform_feedback = id;
+}
+
+static bool enable_changed(GLenum cap, bool on) {
+    for (std::pair<GLenum, bool>& known : shadow.enabled) {
+        if (known.first != cap) continue;
+        if (known.second == on) return false;
+        known.second = on;
+        return true;
+    }
+    shadow.enabled.push_back(std::make_pair(cap, on));
+    return true;
+}
+
+static void GLAD_API_PTR cached_enable(GLenum cap) {
+    if (issue(STATE_ENABLE, enable_changed(cap, true))) real.enable(cap);
+}
+
+static void GLAD_API_PTR cached_disable(GLenum cap) {
+    if (issue(STATE_ENABLE, enable_changed(cap, false))) real.disable(cap);
+}
+
+// a deleted program stays current until it is replaced, its name is only
+// reused afterwards
+static void GLAD_API_PTR cached_delete_program(GLuint program) {
+    real.delete_program(program);
+    shadow.program_uniforms.erase(program);
+    if (shadow.program_known && shadow.program == program) shadow.uniforms = nullptr;
+}
+
+// deleting a bound object binds 0 in its place
+static void GLAD_API_PTR cached_delete_buffers(GLsizei n, const GLuint* buffers) {
+    real.delete_buffers(n, buffers);
+    for (GLsizei i = 0; i < n; i++) {
+        for (int slot = 0; slot < num_buffer_slots; slot++) {
+            if (shadow.buffers[slot] == buffers[i]) shadow.buffers[slot] = 0;
+        }
+    }
+}
+
+static void GLAD_API_PTR cached_delete_vertex_arrays(GLsizei n, const GLuint* arrays) {
+    real.delete_vertex_arrays(n, arrays);
+    for (GLsizei i = 0; i < n; i++) {
+        if (shadow.vertex_array == arrays[i]) shadow.vertex_array = 0;
+    }
+}
+
+static void GLAD_API_PTR cached_delete_transform_feedbacks(GLsizei n, const GLuint* ids) {
+    real.delete_transform_feedbacks(n, ids);
+    for (GLsizei i = 0; i < n; i++) {
+        if (shadow.transform_feedback == ids[i]) shadow.transform_feedback = 0;
+    }
+}
+
+// linking resets the uniforms to their defaults
+static void relinked(GLuint program) {
+    shadow.program_uniforms.erase(program);
+    if (shadow.program_known && shadow.program == program) shadow.uniforms = uniforms_of(program);
+}
+
+static void GLAD_API_PTR cached_link_program(GLuint program) {
+    real.link_program(program);
+    relinked(program);
+}
+
+static void GLAD_API_PTR cached_program_binary(GLuint program, GLenum format, const void* binary, GLsizei length) {
+    real.program_binary(program, format, binary, length);
+    relinked(program);
+}
+
+static void GLAD_API_PTR cached_uniform1f(GLint location, GLfloat v0) {
+    GLfloat value[] = { v0 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_1F, value, sizeof(value)))) {
+        real.uniform1f(location, v0);
+    }
+}
+
+static void GLAD_API_PTR cached_uniform1i(GLint location, GLint v0) {
+    GLint value[] = { v0 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_1I, value, sizeof(value)))) {
+        real.uniform1i(location, v0);
+    }
+}
+
+static void GLAD_API_PTR cached_uniform1ui(GLint location, GLuint v0) {
+    GLuint value[] = { v0 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_1UI, value, sizeof(value)))) {
+        real.uniform1ui(location, v0);
+    }
+}
+
+static void GLAD_API_PTR cached_uniform2f(GLint location, GLfloat v0, GLfloat v1) {
+    GLfloat value[] = { v0, v1 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_2F, value, sizeof(value)))) {
+        real.uniform2f(location, v0, v1);
+    }
+}
+
+static void GLAD_API_PTR cached_uniform2i(GLint location, GLint v0, GLint v1) {
+    GLint value[] = { v0, v1 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_2I, value, sizeof(value)))) {
+        real.uniform2i(location, v0, v1);
+    }
+}
+
+static void GLAD_API_PTR cached_uniform2ui(GLint location, GLuint v0, GLuint v1) {
+    GLuint value[] = { v0, v1 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_2UI, value, sizeof(value)))) {
+        real.uniform2ui(location, v0, v1);
+    }
+}
+
+static void GLAD_API_PTR cached_uniform4ui(GLint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3) {
+    GLuint value[] = { v0, v1, v2, v3 };
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_4UI, value, sizeof(value)))) {
+        real.uniform4ui(location, v0, v1, v2, v3);
+    }
+}
+
+// single matrices only, arrays go through and forget their first element
+static void GLAD_API_PTR cached_uniform_matrix4fv(GLint location, GLsizei count, GLboolean transpose,
+                                                  const GLfloat* value) {
+    if (count != 1 || transpose) {
+        forget_uniform(current_uniforms(), location);
+        issue(STATE_UNIFORM, true);
+        real.uniform_matrix4fv(location, count, transpose, value);
+        return;
+    }
+    if (issue(STATE_UNIFORM, uniform_changed(current_uniforms(), location, UNIFORM_MATRIX4F, value, 16 * sizeof(GLfloat)))) {
+        real.uniform_matrix4fv(location, count, transpose, value);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform1f(GLuint program, GLint location, GLfloat v0) {
+    GLfloat value[] = { v0 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_1F, value, sizeof(value)))) {
+        real.program_uniform1f(program, location, v0);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform1i(GLuint program, GLint location, GLint v0) {
+    GLint value[] = { v0 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_1I, value, sizeof(value)))) {
+        real.program_uniform1i(program, location, v0);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform1ui(GLuint program, GLint location, GLuint v0) {
+    GLuint value[] = { v0 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_1UI, value, sizeof(value)))) {
+        real.program_uniform1ui(program, location, v0);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform2f(GLuint program, GLint location, GLfloat v0, GLfloat v1) {
+    GLfloat value[] = { v0, v1 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_2F, value, sizeof(value)))) {
+        real.program_uniform2f(program, location, v0, v1);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform2i(GLuint program, GLint location, GLint v0, GLint v1) {
+    GLint value[] = { v0, v1 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_2I, value, sizeof(value)))) {
+        real.program_uniform2i(program, location, v0, v1);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform2ui(GLuint program, GLint location, GLuint v0, GLuint v1) {
+    GLuint value[] = { v0, v1 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_2UI, value, sizeof(value)))) {
+        real.program_uniform2ui(program, location, v0, v1);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform4ui(GLuint program, GLint location, GLuint v0, GLuint v1, GLuint v2,
+                                                   GLuint v3) {
+    GLuint value[] = { v0, v1, v2, v3 };
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_4UI, value, sizeof(value)))) {
+        real.program_uniform4ui(program, location, v0, v1, v2, v3);
+    }
+}
+
+static void GLAD_API_PTR cached_program_uniform_matrix4fv(GLuint program, GLint location, GLsizei count,
+                                                          GLboolean transpose, const GLfloat* value) {
+    if (count != 1 || transpose) {
+        forget_uniform(uniforms_of(program), location);
+        issue(STATE_UNIFORM, true);
+        real.program_uniform_matrix4fv(program, location, count, transpose, value);
+        return;
+    }
+    if (issue(STATE_UNIFORM, uniform_changed(uniforms_of(program), location, UNIFORM_MATRIX4F, value, 16 * sizeof(GLfloat)))) {
+        real.program_uniform_matrix4fv(program, location, count, transpose, value);
+    }
+}
+
+// keeps the driver's entry point and puts the cached one in its place.
+// entry points the context lacks (es 3.1 ones on 3.0) stay null
+template <typename F>
+static void hook(F* function, F* saved, F cached) {
+    *saved = *function;
+    if (*function) *function = cached;
+}
+
+void state_cache_install() {
+    if (installed) return;
+    installed = true;
+    hook(&glad_glUseProgram, &real.use_program, cached_use_program);
+    hook(&glad_glBindVertexArray, &real.bind_vertex_array, cached_bind_vertex_array);
+    hook(&glad_glBindBuffer, &real.bind_buffer, cached_bind_buffer);
+    hook(&glad_glBindBufferBase, &real.bind_buffer_base, cached_bind_buffer_base);
+    hook(&glad_glBindBufferRange, &real.bind_buffer_range, cached_bind_buffer_range);
+    hook(&glad_glBindTransformFeedback, &real.bind_transform_feedback, cached_bind_transform_feedback);
+    hook(&glad_glEnable, &real.enable, cached_enable);
+    hook(&glad_glDisable, &real.disable, cached_disable);
+    hook(&glad_glDeleteProgram, &real.delete_program, cached_delete_program);
+    hook(&glad_glDeleteBuffers, &real.delete_buffers, cached_delete_buffers);
+    hook(&glad_glDeleteVertexArrays, &real.delete_vertex_arrays, cached_delete_vertex_arrays);
+    hook(&glad_glDeleteTransformFeedbacks, &real.delete_transform_feedbacks, cached_delete_transform_feedbacks);
+    hook(&glad_glLinkProgram, &real.link_program, cached_link_program);
+    hook(&glad_glProgramBinary, &real.program_binary, cached_program_binary);
+    hook(&glad_glUniform1f, &real.uniform1f, cached_uniform1f);
+    hook(&glad_glUniform1i, &real.uniform1i, cached_uniform1i);
+    hook(&glad_glUniform1ui, &real.uniform1ui, cached_uniform1ui);
+    hook(&glad_glUniform2f, &real.uniform2f, cached_uniform2f);
+    hook(&glad_glUniform2i, &real.uniform2i, cached_uniform2i);
+    hook(&glad_glUniform2ui, &real.uniform2ui, cached_uniform2ui);
+    hook(&glad_glUniform4ui, &real.uniform4ui, cached_uniform4ui);
+    hook(&glad_glUniformMatrix4fv, &real.uniform_matrix4fv, cached_uniform_matrix4fv);
+    hook(&glad_glProgramUniform1f, &real.program_uniform1f, cached_program_uniform1f);
+    hook(&glad_glProgramUniform1i, &real.program_uniform1i, cached_program_uniform1i);
+    hook(&glad_glProgramUniform1ui, &real.program_uniform1ui, cached_program_uniform1ui);
+    hook(&glad_glProgramUniform2f, &real.program_uniform2f, cached_program_uniform2f);
+    hook(&glad_glProgramUniform2i, &real.program_uniform2i, cached_program_uniform2i);
+    hook(&glad_glProgramUniform2ui, &real.program_uniform2ui, cached_program_uniform2ui);
+    hook(&glad_glProgramUniform4ui, &real.program_uniform4ui, cached_program_uniform4ui);
+    hook(&glad_glProgramUniformMatrix4fv, &real.program_uniform_matrix4fv, cached_program_uniform_matrix4fv);
+}
+
+bool state_cache_installed() {
+    return installed;
+}
+
+void state_cache_reset() {
+    state_cache_counters counters = shadow.counters;
+    shadow = shadow_state();
+    shadow.counters = counters;
+}
+
+state_cache_counters state_cache_get_counters() {
+    return shadow.counters;
+}
+
+void state_cache_reset_counters() {
+    shadow.counters = state_cache_counters();
+}
@@ -0,0 +1,54 @@
+#ifndef PARTICLES_STATE_CACHE_H_
+#define PARTICLES_STATE_CACHE_H_
+
+#include <glad/gles2.h>
+
+// shadow of the gl state the frames set over and over (--state-cache). it
+// swaps glad2's function pointers for ones that remember the bound program,
+// vertex array, buffers and transform feedback, the enable bits and the
+// uniform values of every program, and drop calls that would not change
+// any of them. the drivers validate every call, redundant or not, so each
+// dropped call saves that work. code keeps calling glUseProgram and so on
+// as before.
+//
+// the shadow is per thread, each thread with a context of its own tracks
+// it separately. it starts out unknown, the first call of each kind goes
+// through. state changed behind its back, by a library using its own
+// function pointers say, needs state_cache_reset. deleting bound objects
+// and relinking programs are tracked. not shadowed: the element array and
+// transform feedback buffer bindings (they belong to the vertex array and
+// transform feedback objects) and the indexed bindings.
+
+enum state_kind {
+    STATE_PROGRAM,             // glUseProgram
+    STATE_VERTEX_ARRAY,        // glBindVertexArray
+    STATE_BUFFER,              // glBindBuffer
+    STATE_TRANSFORM_FEEDBACK,  // glBindTransformFeedback
+    STATE_ENABLE,              // glEnable, glDisable
+    STATE_UNIFORM,             // glUniform* and glProgramUniform*, the variants in use
+    num_state_kinds
+};
+
+const char* state_kind_name(state_kind kind);
+
+// calls of each kind since the last state_cache_reset_counters, on the
+// calling thread
+struct state_cache_counters {
+    long long issued[num_state_kinds];  // passed on to the driver
+    long long elided[num_state_kinds];  // dropped, the state already matched
+};
+
+// replaces the function pointers, after gladLoadGLES2. once, later calls
+// do nothing. gladLoadGLES2 again undoes it
+void state_cache_install();
+
+bool state_cache_installed();
+
+// forgets the shadow of the calling thread, the next call of each kind
+// goes through
+void state_cache_reset();
+
+state_cache_counters state_cache_get_counters();
+void state_cache_reset_counters();
+
+#endif  // PARTICLES_STATE_CACHE_H_
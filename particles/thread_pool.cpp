@@ -0,0 +1,108 @@
+#include "thread_pool.h"
+
+thread_pool::thread_pool(int num_threads) : remaining_(0) {
+    if (num_threads <= 0) num_threads = (int)std::thread::hardware_concurrency();
+    if (num_threads <= 0) num_threads = 1;
+
+    for (int i = 0; i < num_threads; i++) {
+        queues_.emplace_back(new task_queue());
+    }
+    // slot 0 belongs to the thread calling parallel_for
+    for (int i = 1; i < num_threads; i++) {
+        threads_.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void thread_pool::parallel_for(int num_tasks, const std::function<void(int)>& fn) {
+    if (num_tasks <= 0) return;
+
+    for (int task = 0; task < num_tasks; task++) {
+        task_queue& queue = *queues_[task % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    remaining_ = num_tasks;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = &fn;
+        generation_++;
+    }
+    wake_.notify_all();
+
+    run_tasks(0, &fn);
+
+    // workers that woke up for this job may still be running a stolen task
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return remaining_ == 0 && active_ == 0; });
+    fn_ = nullptr;
+}
+
+void thread_pool::worker_loop(int index) {
+    unsigned seen = 0;
+    for (;;) {
+        const std::function<void(int)>* fn;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+            fn = fn_;
+            active_++;
+        }
+
+        if (fn) run_tasks(index, fn);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_--;
+        }
+        done_.notify_all();
+    }
+}
+
+void thread_pool::run_tasks(int index, const std::function<void(int)>* fn) {
+    int task;
+    while (pop_task(index, &task)) {
+        (*fn)(task);
+        if (--remaining_ == 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+bool thread_pool::pop_task(int index, int* task) {
+    // own deque from the back (most recently dealt, still warm)
+    {
+        task_queue& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            *task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // steal the oldest task of the next non-empty deque
+    int n = (int)queues_.size();
+    for (int k = 1; k < n; k++) {
+        task_queue& victim = *queues_[(index + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            *task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
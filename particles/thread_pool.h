@@ -0,0 +1,54 @@
+#ifndef PARTICLES_THREAD_POOL_H_
+#define PARTICLES_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed size pool with one task deque per thread. parallel_for deals the
+// tasks out round-robin, every thread drains its own deque from the back
+// and steals from the front of the others once it runs dry, so uneven
+// tasks (page faults, a core busy with the driver) even out on their own.
+// the calling thread takes part as thread 0.
+class thread_pool {
+public:
+    // num_threads includes the caller, 0 means one per hardware thread
+    explicit thread_pool(int num_threads = 0);
+    ~thread_pool();
+
+    int size() const { return (int)queues_.size(); }
+
+    // runs fn(task) for every task in [0, num_tasks) and returns once all of
+    // them are done. not reentrant, call it from one thread only
+    void parallel_for(int num_tasks, const std::function<void(int)>& fn);
+
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    void worker_loop(int index);
+    void run_tasks(int index, const std::function<void(int)>* fn);
+    bool pop_task(int index, int* task);
+
+    std::vector<std::unique_ptr<task_queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;                  // guards the fields below
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(int)>* fn_ = nullptr;
+    unsigned generation_ = 0;
+    int active_ = 0;
+    bool stop_ = false;
+
+    std::atomic<int> remaining_;
+};
+
+#endif  // PARTICLES_THREAD_POOL_H_